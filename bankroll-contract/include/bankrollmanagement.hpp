@@ -1,4 +1,6 @@
 #include <math.h>
+#include <algorithm>
+#include <vector>
 #include <eosio/print.hpp>
 
 /**
@@ -72,22 +74,186 @@ class ChainedRange {
 
 //This probably makes absolutely no sense to you.
 //I will soon publish an article explaining why and how this works
+double getRangeVariance(uint32_t lowerBound, uint32_t upperBound, uint64_t payout, uint64_t totalBetAmount, uint32_t maxRangeLimit) {
+  //Only losing ranges are considered
+  if (payout <= totalBetAmount) {
+    return 0;
+  }
+  //dds of this range winning
+  double odds = (double)(upperBound - lowerBound + 1) / (double)maxRangeLimit;
+  //This factor is the max percentage of the bankroll that could be bet on this result, if it were the only bet
+  double maxBetFactor = 5.0 / sqrt((1.0 / odds) - 1.0) - 0.2;
+  //This is the amount that the bankroll has to play if this range wins, plus the initial bet amount on this range
+  double effectivePayout = ((double) (payout - totalBetAmount) + (double)payout * odds);
+  //The odds of going losing 50% of the bankroll in 100 bets approximately grows proportional to the cube of the relative size of the bet
+  return pow(effectivePayout * odds / maxBetFactor, 3);
+}
+
+
 asset getRequiredBankroll(ChainedRange firstRange, uint64_t totalBetAmount, uint32_t maxRangeLimit) {
   double variance = 0;
   ChainedRange* currentRangePtr = &firstRange;
   while (currentRangePtr != nullptr) {
+    variance += getRangeVariance(currentRangePtr->lowerBound, currentRangePtr->upperBound, currentRangePtr->payout, totalBetAmount, maxRangeLimit);
+    currentRangePtr = currentRangePtr->next;
+  }
+  variance = cbrt(variance);
+  
+  uint64_t requiredBankrollAmount = (uint64_t)(variance * 125.0);
+  return asset(requiredBankrollAmount, symbol("WAX", 8));
+}
+
+
+/**
+ * Calculates the variance of a roll with multiple independent draws, before the cube root is taken
+ * Variances of independent rolls can be added up, see getMultiDrawRequiredBankroll
+ */
+double getMultiDrawVariance(std::vector<ChainedRange>& firstRanges, std::vector<uint64_t>& totalBetAmounts, uint32_t maxRangeLimit) {
+  double variance = 0;
+  for (size_t i = 0; i < firstRanges.size(); i++) {
+    ChainedRange* currentRangePtr = &firstRanges[i];
+    while (currentRangePtr != nullptr) {
+      variance += getRangeVariance(currentRangePtr->lowerBound, currentRangePtr->upperBound, currentRangePtr->payout, totalBetAmounts[i], maxRangeLimit);
+      currentRangePtr = currentRangePtr->next;
+    }
+  }
+  return variance;
+}
+
+
+/**
+ * Returns the bankroll amount that a variance requires, the same way as getRequiredBankroll
+ */
+double getRequiredBankrollFromVariance(double variance) {
+  return cbrt(variance) * 125.0;
+}
+
+
+/**
+ * Calculates the required bankroll of a roll with multiple independent draws
+ * Each draw has its own ranges and total bet amount. The variances of all draws are added up before taking the cube root,
+ * the same way as the variances of the ranges of a single draw are. With only one draw, the result is equal to getRequiredBankroll
+ */
+asset getMultiDrawRequiredBankroll(std::vector<ChainedRange>& firstRanges, std::vector<uint64_t>& totalBetAmounts, uint32_t maxRangeLimit) {
+  uint64_t requiredBankrollAmount = (uint64_t)getRequiredBankrollFromVariance(getMultiDrawVariance(firstRanges, totalBetAmounts, maxRangeLimit));
+  return asset(requiredBankrollAmount, symbol("WAX", 8));
+}
+
+
+/**
+ * Calculates the required bankroll of a roll that only has a single bet in constant time
+ * A single bet only creates one losing range, so no ranges need to be built. The result is equal to getRequiredBankroll
+ */
+asset getSingleBetRequiredBankroll(uint64_t betAmount, uint32_t betLowerBound, uint32_t betUpperBound, uint32_t betMultiplier, uint32_t maxRangeLimit) {
+  double ev = (double)betMultiplier / 1000.0 * (double)(betUpperBound - betLowerBound + 1) / (double)maxRangeLimit;
+  uint64_t totalBetAmount = (uint64_t)((double)betAmount * (ev + 0.007));
+  uint64_t payout = betAmount * betMultiplier / 1000;
+  
+  double variance = cbrt(getRangeVariance(betLowerBound, betUpperBound, payout, totalBetAmount, maxRangeLimit));
+  
+  uint64_t requiredBankrollAmount = (uint64_t)(variance * 125.0);
+  return asset(requiredBankrollAmount, symbol("WAX", 8));
+}
+
+
+//maxBetFactor (see getRangeVariance) is only positive for odds above 1/626. Above that, odds / maxBetFactor falls until the odds
+//are about 0.0064, then rises to its maximum of 0.10426 at about 0.478 and falls to 0 at odds of 1
+const double MAX_WIDE_RANGE_RISK = 0.1043;
+const double MAX_WIDE_RANGE_RISK_ODDS = 0.478;
+
+
+/**
+ * Returns odds / maxBetFactor of a range with the given odds, see getRangeVariance
+ */
+double getRangeRisk(double odds) {
+  double maxBetFactor = 5.0 / sqrt((1.0 / odds) - 1.0) - 0.2;
+  return odds / maxBetFactor;
+}
+
+
+/**
+ * Calculates an upper limit of the variance of the ranges of a roll (see getRequiredBankroll) in constant time, without building the ranges
+ * 
+ * The payout of every range is at most payoutSum, so the effective payout of a losing range with the odds o is at most
+ * payoutSum * (1 + o) - totalBetAmount. The possible odds are split into intervals, and for each interval the largest effective payout
+ * is multiplied with the largest odds / maxBetFactor within it, which is at one of its ends or at the maximum at about 0.478.
+ * Ranges with a negative maxBetFactor reduce the variance and are left out. The narrowest range with a positive maxBetFactor
+ * can be narrower than any bet, because the ranges are the intersections of the bets, so the intervals start at this range
+ * 
+ * A roll with n bets has at most 2n + 1 ranges. The result is increased by 0.1% to absorb floating point rounding
+ * See tools/variance_bound_check.cpp for a check against getRequiredBankroll. The bound is far above the exact value for most rolls,
+ * so it only lets rolls that require a small part of the bankroll skip the exact calculation, see tools/README.md
+ * 
+ * @param payoutSum - The sum of the payouts of all bets
+ * @param totalBetAmount - The total bet amount collected from all bets, the same as for getRequiredBankroll
+ * @param betCount - The number of bets
+ */
+double getVarianceBound(uint64_t payoutSum, uint64_t totalBetAmount, uint32_t betCount, uint32_t maxRangeLimit) {
+  if (betCount == 0 || payoutSum <= totalBetAmount) {
+    return 0;
+  }
+  
+  //The narrowest range with a positive maxBetFactor is a bit wider than maxRangeLimit / 626. The candidates are checked because of rounding
+  uint32_t narrowestWidth = std::max(maxRangeLimit / 626, (uint32_t)1);
+  double lowerOdds = 1;
+  for (uint32_t width = narrowestWidth; width <= narrowestWidth + 2 && width <= maxRangeLimit; width++) {
+    double odds = (double)width / (double)maxRangeLimit;
+    double maxBetFactor = 5.0 / sqrt((1.0 / odds) - 1.0) - 0.2;
+    if (maxBetFactor == 0) {
+      //The variance of such a range is infinite
+      return INFINITY;
+    }
+    if (maxBetFactor > 0) {
+      lowerOdds = odds;
+      break;
+    }
+  }
+  
+  //The intervals double up to odds of 1/16 and then grow linearly, where the effective payout grows the most
+  double maxRiskPayout = 0;
+  double lowerRisk = getRangeRisk(lowerOdds);
+  while (lowerOdds < 1) {
+    double upperOdds = std::min(lowerOdds < 0.0625 ? lowerOdds * 2 : lowerOdds + 0.0625, 1.0);
+    double upperRisk = getRangeRisk(upperOdds);
     
-    //Only losing ranges are considered
-    if (currentRangePtr->payout > totalBetAmount) {
-      //dds of this range winning
-      double odds = (double)(currentRangePtr->upperBound - currentRangePtr->lowerBound + 1) / (double)maxRangeLimit;
-      //This factor is the max percentage of the bankroll that could be bet on this result, if it were the only bet
-      double maxBetFactor = 5.0 / sqrt((1.0 / odds) - 1.0) - 0.2;
-      //This is the amount that the bankroll has to play if this range wins, plus the initial bet amount on this range
-      double effectivePayout = ((double) (currentRangePtr->payout - totalBetAmount) + (double)currentRangePtr->payout * odds);
-      //The odds of going losing 50% of the bankroll in 100 bets approximately grows proportional to the cube of the relative size of the bet
-      variance += pow(effectivePayout * odds / maxBetFactor, 3);
+    double maxEffectivePayout = (double)payoutSum * (1.0 + upperOdds) - (double)totalBetAmount;
+    if (maxEffectivePayout > 0) {
+      double maxRisk = std::max(lowerRisk, upperRisk);
+      if (lowerOdds < MAX_WIDE_RANGE_RISK_ODDS + 0.01 && upperOdds > MAX_WIDE_RANGE_RISK_ODDS - 0.01) {
+        maxRisk = std::max(maxRisk, MAX_WIDE_RANGE_RISK);
+      }
+      maxRiskPayout = std::max(maxRiskPayout, maxEffectivePayout * maxRisk);
     }
+    
+    lowerOdds = upperOdds;
+    lowerRisk = upperRisk;
+  }
+  
+  double rangeCount = 2.0 * betCount + 1.0;
+  return rangeCount * pow(maxRiskPayout, 3) * 1.001;
+}
+
+
+/**
+ * Returns the bankroll amount that an upper limit of the variance (see getVarianceBound) requires
+ * It is never smaller than the amount that getRequiredBankroll returns for the same bets
+ */
+double getRequiredBankrollBound(double varianceBound) {
+  return getRequiredBankrollFromVariance(varianceBound) + 1.0;
+}
+
+
+/**
+ * Calculates the required bankroll if all bets of the ranges were scaled by the same factor
+ * The scaled payouts and the scaled total bet amount are rounded down, like the amounts of scaled bets are
+ */
+asset getScaledRequiredBankroll(ChainedRange firstRange, uint64_t totalBetAmount, uint32_t maxRangeLimit, double scale) {
+  uint64_t scaledTotalBetAmount = (uint64_t)((double)totalBetAmount * scale);
+  double variance = 0;
+  ChainedRange* currentRangePtr = &firstRange;
+  while (currentRangePtr != nullptr) {
+    uint64_t scaledPayout = (uint64_t)((double)currentRangePtr->payout * scale);
+    variance += getRangeVariance(currentRangePtr->lowerBound, currentRangePtr->upperBound, scaledPayout, scaledTotalBetAmount, maxRangeLimit);
     currentRangePtr = currentRangePtr->next;
   }
   variance = cbrt(variance);
@@ -95,3 +261,359 @@ asset getRequiredBankroll(ChainedRange firstRange, uint64_t totalBetAmount, uint
   uint64_t requiredBankrollAmount = (uint64_t)(variance * 125.0);
   return asset(requiredBankrollAmount, symbol("WAX", 8));
 }
+
+
+/**
+ * Finds the largest factor 0 <= scale <= 1, so that the bets of the ranges scaled by this factor fit into the bankroll
+ * 
+ * Scaling all bets by the same factor scales every range payout and the total bet amount alike. Which ranges are losing
+ * therefore stays the same, and the required bankroll grows linearly with the factor. This gives bankroll / requiredBankroll
+ * as the analytic solution. Because scaled amounts are rounded down, this solution is verified on the already built ranges
+ * and if it doesn't fit, it is corrected with a bounded bisection
+ */
+double getMaxScaleFactor(ChainedRange firstRange, uint64_t totalBetAmount, uint32_t maxRangeLimit, asset requiredBankroll, asset bankroll) {
+  if (requiredBankroll <= bankroll) {
+    return 1.0;
+  }
+  
+  double scale = (double)bankroll.amount / (double)requiredBankroll.amount;
+  if (getScaledRequiredBankroll(firstRange, totalBetAmount, maxRangeLimit, scale) <= bankroll) {
+    return scale;
+  }
+  
+  double lowerScale = 0;
+  double upperScale = scale;
+  for (int i = 0; i < 32; i++) {
+    double middleScale = (lowerScale + upperScale) / 2;
+    if (getScaledRequiredBankroll(firstRange, totalBetAmount, maxRangeLimit, middleScale) <= bankroll) {
+      lowerScale = middleScale;
+    } else {
+      upperScale = middleScale;
+    }
+  }
+  return lowerScale;
+}
+
+
+/**
+ * Calculates the required bankroll if an additional bet were added to the ranges
+ * The ranges need to already be split at the bounds of the additional bet, so that every range is either fully inside or outside of the bet
+ * 
+ * @param totalBetAmount - The total bet amount collected, already including the amount collected from the additional bet
+ */
+asset getRequiredBankrollWithBet(ChainedRange firstRange, uint64_t totalBetAmount, uint32_t maxRangeLimit, uint32_t betLowerBound, uint32_t betUpperBound, uint64_t betPayout) {
+  double variance = 0;
+  ChainedRange* currentRangePtr = &firstRange;
+  while (currentRangePtr != nullptr) {
+    uint64_t payout = currentRangePtr->payout;
+    if (betLowerBound <= currentRangePtr->lowerBound && currentRangePtr->upperBound <= betUpperBound) {
+      payout += betPayout;
+    }
+    variance += getRangeVariance(currentRangePtr->lowerBound, currentRangePtr->upperBound, payout, totalBetAmount, maxRangeLimit);
+    currentRangePtr = currentRangePtr->next;
+  }
+  variance = cbrt(variance);
+  
+  uint64_t requiredBankrollAmount = (uint64_t)(variance * 125.0);
+  return asset(requiredBankrollAmount, symbol("WAX", 8));
+}
+
+
+/**
+ * Finds the largest amount that can be bet on betLowerBound <= result <= betUpperBound with the given multiplier,
+ * so that the ranges including this bet still fit into the bankroll
+ * 
+ * Without other bets, the required bankroll grows linearly with the bet amount, which gives an analytic solution.
+ * With other bets, the amount is found with a bounded bisection. In both cases, the result is verified to fit into the bankroll
+ * 
+ * Note: The ranges are split at the bounds of the bet. This does not change the required bankroll of the ranges
+ * 
+ * The amount is limited to the largest amount whose payout is still a valid asset amount,
+ * so that neither the payout nor the sums of the payouts in the ranges can overflow
+ * 
+ * @param totalBetAmount - The total bet amount collected from the bets already inserted into the ranges
+ */
+uint64_t getMaxBetAmount(ChainedRange& firstRange, uint64_t totalBetAmount, uint32_t maxRangeLimit, uint32_t betLowerBound, uint32_t betUpperBound, uint32_t betMultiplier, asset bankroll) {
+  firstRange.insertBet(betLowerBound, betUpperBound, 0);
+  double ev = (double)betMultiplier / 1000.0 * (double)(betUpperBound - betLowerBound + 1) / (double)maxRangeLimit;
+  uint64_t maxAmount = (uint64_t)std::min((uint128_t)asset::max_amount, (uint128_t)asset::max_amount * 1000 / betMultiplier);
+  
+  auto fitsBankroll = [&](uint64_t amount) {
+    uint64_t collected = totalBetAmount + (uint64_t)((double)amount * (ev + 0.007));
+    uint64_t payout = (uint64_t)((uint128_t)amount * betMultiplier / 1000);
+    return getRequiredBankrollWithBet(firstRange, collected, maxRangeLimit, betLowerBound, betUpperBound, payout) <= bankroll;
+  };
+  
+  uint64_t lowerAmount = 0;
+  uint64_t upperAmount;
+  if (totalBetAmount == 0) {
+    //Analytic solution, using a large reference amount to keep rounding errors small
+    const uint64_t referenceAmount = 1000000000000;
+    asset referenceRequiredBankroll = getRequiredBankrollWithBet(firstRange, (uint64_t)((double)referenceAmount * (ev + 0.007)), maxRangeLimit, betLowerBound, betUpperBound, (uint64_t)((uint128_t)referenceAmount * betMultiplier / 1000));
+    double amount = (double)bankroll.amount / (double)referenceRequiredBankroll.amount * (double)referenceAmount;
+    upperAmount = amount < (double)maxAmount ? (uint64_t)amount : maxAmount;
+    if (fitsBankroll(upperAmount)) {
+      return upperAmount;
+    }
+  } else {
+    //Other bets can hedge this bet, so the single bet maximum is not an upper bound. It is doubled until it doesn't fit anymore
+    upperAmount = std::min((uint64_t)bankroll.amount, maxAmount);
+    for (int i = 0; i < 16 && fitsBankroll(upperAmount); i++) {
+      if (upperAmount == maxAmount) {
+        return maxAmount;
+      }
+      lowerAmount = upperAmount;
+      upperAmount = std::min(upperAmount * 2, maxAmount);
+    }
+  }
+  
+  for (int i = 0; i < 64 && lowerAmount + 1 < upperAmount; i++) {
+    uint64_t middleAmount = lowerAmount + (upperAmount - lowerAmount) / 2;
+    if (fitsBankroll(middleAmount)) {
+      lowerAmount = middleAmount;
+    } else {
+      upperAmount = middleAmount;
+    }
+  }
+  return lowerAmount;
+}
+
+
+/**
+ * The following code specializes the risk evaluation and the result calculation for common max results, that are known at compile time
+ * 
+ * With a constant max result, the odds of a range only divide by a constant and the results use the modulo of a constant,
+ * which the compiler reduces to multiplications and shifts. The ranges are kept in fixed size arrays on the stack instead of
+ * heap allocated ChainedRanges. getFixedVariance and getRollResult pick the specialization at runtime and return the same results as the generic code
+ */
+
+//Max number of bets that FixedRanges can hold. Rolls with more bets use ChainedRange
+const uint32_t MAX_FIXED_RANGE_BETS = 64;
+
+
+/**
+ * The ranges of a roll with a max result that is known at compile time
+ * The bounds of the bets are kept sorted, together with the change of the payout at each bound.
+ * The ranges are then the segments between the bounds, which are the same ranges that ChainedRange builds
+ */
+template<uint32_t MaxResult>
+class FixedRanges {
+  public:
+    
+    //Returns false if there is no space for the bet left. The bet is not inserted then
+    bool insertBet(uint32_t betLowerBound, uint32_t betUpperBound, uint64_t betAmount) {
+      if (boundCount + 2 > 2 * MAX_FIXED_RANGE_BETS) {
+        return false;
+      }
+      insertBound(betLowerBound, betAmount);
+      if (betUpperBound < MaxResult) {
+        //The payouts are unsigned, the sum of all changes up to a bound wraps around to the payout of the range after it
+        insertBound(betUpperBound + 1, 0 - betAmount);
+      }
+      return true;
+    }
+    
+    //Same as the variance of getRequiredBankroll, the ranges are added in the same order
+    double getVariance(uint64_t totalBetAmount) const {
+      double variance = 0;
+      uint32_t lowerBound = 1;
+      uint64_t payout = 0;
+      for (uint32_t i = 0; i < boundCount; i++) {
+        if (positions[i] > lowerBound) {
+          variance += getRangeVariance(lowerBound, positions[i] - 1, payout, totalBetAmount, MaxResult);
+          lowerBound = positions[i];
+        }
+        payout += payoutChanges[i];
+      }
+      variance += getRangeVariance(lowerBound, MaxResult, payout, totalBetAmount, MaxResult);
+      return variance;
+    }
+    
+  private:
+    
+    uint32_t positions[2 * MAX_FIXED_RANGE_BETS];
+    uint64_t payoutChanges[2 * MAX_FIXED_RANGE_BETS];
+    uint32_t boundCount = 0;
+    
+    //Insertion sort, which is fast for the small number of bounds
+    void insertBound(uint32_t position, uint64_t payoutChange) {
+      uint32_t i = boundCount++;
+      while (i > 0 && positions[i - 1] > position) {
+        positions[i] = positions[i - 1];
+        payoutChanges[i] = payoutChanges[i - 1];
+        i--;
+      }
+      positions[i] = position;
+      payoutChanges[i] = payoutChange;
+    }
+};
+
+
+template<uint32_t MaxResult, typename F>
+bool getFixedVarianceOf(uint64_t totalBetAmount, F insertBets, double& variance) {
+  FixedRanges<MaxResult> ranges;
+  if (!insertBets(ranges)) {
+    return false;
+  }
+  variance = ranges.getVariance(totalBetAmount);
+  return true;
+}
+
+
+/**
+ * Calculates the variance of a roll (see getRequiredBankroll) with the FixedRanges of its max result
+ * Returns false if there is no specialization for the max result or the roll has too many bets. The ChainedRanges need to be built then
+ * 
+ * @param betCount - The number of bets of the roll
+ * @param insertBets - Function that inserts all bets into the FixedRanges it is called with, and returns false if one didn't fit
+ * @param variance - Is set to the variance if true is returned
+ */
+template<typename F>
+bool getFixedVariance(uint32_t maxRangeLimit, uint32_t betCount, uint64_t totalBetAmount, F insertBets, double& variance) {
+  if (betCount > MAX_FIXED_RANGE_BETS) {
+    return false;
+  }
+  switch (maxRangeLimit) {
+    case 2: return getFixedVarianceOf<2>(totalBetAmount, insertBets, variance);
+    case 6: return getFixedVarianceOf<6>(totalBetAmount, insertBets, variance);
+    case 100: return getFixedVarianceOf<100>(totalBetAmount, insertBets, variance);
+    case 10000: return getFixedVarianceOf<10000>(totalBetAmount, insertBets, variance);
+  }
+  return false;
+}
+
+
+/**
+ * Index of the payouts of the bets of a roll for every result, for rolls with too many bets for FixedRanges
+ * The results are compressed to the ranges between the bounds of the bets, which are the same ranges that ChainedRange builds.
+ * The payout changes at the start of each range are kept both as they are, for sweeps over all ranges in O(n),
+ * and in a Fenwick tree, so that inserting a bet and getting the payout of a single result take O(log n)
+ * 
+ * Usage: addBetBounds for every bet, then build, then insertBet for every bet
+ */
+class ExposureIndex {
+  public:
+    
+    ExposureIndex(uint32_t maxRangeLimit) : maxRangeLimit(maxRangeLimit) {
+      rangeStarts.push_back(1);
+    }
+    
+    void addBetBounds(uint32_t betLowerBound, uint32_t betUpperBound) {
+      rangeStarts.push_back(betLowerBound);
+      if (betUpperBound < maxRangeLimit) {
+        rangeStarts.push_back(betUpperBound + 1);
+      }
+    }
+    
+    void build() {
+      std::sort(rangeStarts.begin(), rangeStarts.end());
+      rangeStarts.erase(std::unique(rangeStarts.begin(), rangeStarts.end()), rangeStarts.end());
+      payoutChanges.assign(rangeStarts.size(), 0);
+      tree.assign(rangeStarts.size() + 1, 0);
+    }
+    
+    //The bounds of the bet need to have been added with addBetBounds
+    void insertBet(uint32_t betLowerBound, uint32_t betUpperBound, uint64_t betAmount) {
+      addPayoutChange(getRangeIndex(betLowerBound), betAmount);
+      if (betUpperBound < maxRangeLimit) {
+        //The payouts are unsigned, the sum of all changes up to a range wraps around to its payout, the same as in FixedRanges
+        addPayoutChange(getRangeIndex(betUpperBound + 1), 0 - betAmount);
+      }
+    }
+    
+    uint32_t getRangeCount() const {
+      return rangeStarts.size();
+    }
+    
+    uint32_t getLowerBound(uint32_t rangeIndex) const {
+      return rangeStarts[rangeIndex];
+    }
+    
+    uint32_t getUpperBound(uint32_t rangeIndex) const {
+      return rangeIndex + 1 < rangeStarts.size() ? rangeStarts[rangeIndex + 1] - 1 : maxRangeLimit;
+    }
+    
+    //Index of the range that contains the result
+    uint32_t getRangeIndex(uint32_t result) const {
+      return std::upper_bound(rangeStarts.begin(), rangeStarts.end(), result) - rangeStarts.begin() - 1;
+    }
+    
+    //Total payout of all bets if the result is rolled
+    uint64_t getPayout(uint32_t result) const {
+      uint64_t payout = 0;
+      for (uint32_t i = getRangeIndex(result) + 1; i > 0; i -= i & (0 - i)) {
+        payout += tree[i];
+      }
+      return payout;
+    }
+    
+    //Calls handleRange with the index and the payout of every range, in ascending order
+    template<typename F>
+    void forEachRange(F handleRange) const {
+      uint64_t payout = 0;
+      for (uint32_t i = 0; i < rangeStarts.size(); i++) {
+        payout += payoutChanges[i];
+        handleRange(i, payout);
+      }
+    }
+    
+    uint64_t getMaxPayout() const {
+      uint64_t maxPayout = 0;
+      forEachRange([&](uint32_t rangeIndex, uint64_t payout) {
+        maxPayout = std::max(maxPayout, payout);
+      });
+      return maxPayout;
+    }
+    
+    //Same as the variance of getRequiredBankroll, the ranges are added in the same order
+    double getVariance(uint64_t totalBetAmount) const {
+      double variance = 0;
+      forEachRange([&](uint32_t rangeIndex, uint64_t payout) {
+        variance += getRangeVariance(getLowerBound(rangeIndex), getUpperBound(rangeIndex), payout, totalBetAmount, maxRangeLimit);
+      });
+      return variance;
+    }
+    
+  private:
+    
+    uint32_t maxRangeLimit;
+    //Lower bound of every range, sorted
+    std::vector<uint32_t> rangeStarts;
+    std::vector<uint64_t> payoutChanges;
+    //Fenwick tree of the payoutChanges, 1-indexed
+    std::vector<uint64_t> tree;
+    
+    void addPayoutChange(uint32_t rangeIndex, uint64_t payoutChange) {
+      payoutChanges[rangeIndex] += payoutChange;
+      for (uint32_t i = rangeIndex + 1; i < tree.size(); i += i & (0 - i)) {
+        tree[i] += payoutChange;
+      }
+    }
+};
+
+
+/**
+ * Returns randomNumber % MaxResult + 1 without a 128 bit division
+ * randomNumber = high * 2^64 + low, so it is calculated from the 64 bit remainders of high and low
+ */
+template<uint32_t MaxResult>
+uint32_t getFixedResult(uint128_t randomNumber) {
+  constexpr uint64_t highFactor = (UINT64_MAX % MaxResult + 1) % MaxResult;  // = 2^64 % MaxResult
+  uint64_t high = (uint64_t)(randomNumber >> 64) % MaxResult;
+  uint64_t low = (uint64_t)randomNumber % MaxResult;
+  return (uint32_t)((high * highFactor + low) % MaxResult) + 1;
+}
+
+
+/**
+ * Returns the result 1 <= result <= maxResult of a random number, using getFixedResult for the specialized max results
+ */
+uint32_t getRollResult(uint128_t randomNumber, uint32_t maxResult) {
+  switch (maxResult) {
+    case 2: return getFixedResult<2>(randomNumber);
+    case 6: return getFixedResult<6>(randomNumber);
+    case 100: return getFixedResult<100>(randomNumber);
+    case 10000: return getFixedResult<10000>(randomNumber);
+  }
+  return (randomNumber % maxResult) + 1;
+}
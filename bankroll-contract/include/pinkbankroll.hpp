@@ -2,6 +2,7 @@
 #include <eosio/singleton.hpp>
 #include <eosio/print.hpp>
 #include <eosio/asset.hpp>
+#include <eosio/crypto.hpp>
 #include <eosio/transaction.hpp>
 
 using namespace eosio;
@@ -11,27 +12,59 @@ CONTRACT pinkbankroll : public contract {
     using contract::contract;
     pinkbankroll(name receiver, name code, datastream<const char*> ds):contract(receiver, code, ds),
     rollsTable(receiver, receiver.value),
-    payoutsTable(receiver, receiver.value),
+    betsTable(receiver, receiver.value),
+    maskBetsTable(receiver, receiver.value),
+    extCreatorsTable(receiver, receiver.value),
+    shardsTable(receiver, receiver.value),
+    shardTotalsTable(receiver, receiver.value),
+    shardConfigTable(receiver, receiver.value),
+    poolsTable(receiver, receiver.value),
+    withdrawalsTable(receiver, receiver.value),
     statsTable(receiver, receiver.value),
     signvals_table("orng.wax"_n, "orng.wax"_n.value)
     {}
+    ~pinkbankroll();
     
     ACTION init();
     ACTION announceroll(name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient);
+    ACTION announceext(name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient);
+    ACTION announcepool(name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient, uint64_t pool_id);
+    ACTION setdraws(name creator, uint64_t creator_id, uint32_t draw_count);
     ACTION announcebet(name creator, uint64_t creator_id, name bettor, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t random_seed);
+    ACTION announcedraw(name creator, uint64_t creator_id, name bettor, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t random_seed, uint32_t draw_index);
+    ACTION announcemask(name creator, uint64_t creator_id, name bettor, asset quantity, std::vector<uint64_t> result_mask, uint32_t multiplier, uint64_t random_seed, uint32_t draw_index);
     ACTION payoutbet(name from, asset quantity);
+    ACTION poolpayout(name from, uint64_t pool_id, asset quantity);
     ACTION setpaused(bool paused);
+    ACTION setextcreator(name creator, bool registered);
+    ACTION setshard(name account, bool registered);
+    ACTION rebalance(name shard, uint64_t pool_id, asset quantity);
+    ACTION setissuer(name issuer);
+    ACTION syncbankroll(uint64_t pool_id);
+    ACTION reportshard(name shard, name token_contract, asset bankroll);
+    ACTION addpool(name token_contract, symbol token_symbol, symbol share_symbol);
+    ACTION syncsupply(uint64_t pool_id);
+    ACTION processwd(uint64_t pool_id, uint32_t max_count);
+    ACTION cancelwd(uint64_t withdrawal_id);
+    ACTION sweepfees(name recipient, uint64_t pool_id);
+    ACTION migraterolls(uint32_t max_count);
     
     ACTION receiverand(uint64_t assoc_id, checksum256 random_value);
     [[eosio::on_notify("eosio.token::transfer")]] void receivewaxtransfer(name from, name to, asset quantity, std::string memo);
     [[eosio::on_notify("token.pink::transfer")]] void receivepinktransfer(name from, name to, asset quantity, std::string memo);
+    [[eosio::on_notify("*::transfer")]] void receivepooltransfer(name from, name to, asset quantity, std::string memo);
     
     ACTION notifyresult(name creator, uint64_t creator_id, uint32_t result);
+    ACTION notifydraws(name creator, uint64_t creator_id, std::vector<uint32_t> results);
+    ACTION notifyreject(name creator, uint64_t creator_id, asset refund);
   
     ACTION logannounce(uint64_t roll_id, name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient);
     ACTION logbet(uint64_t roll_id, uint64_t bet_id, name bettor, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t random_seed);
+    ACTION logmaskbet(uint64_t roll_id, uint64_t bet_id, name bettor, asset quantity, std::vector<uint64_t> result_mask, uint32_t multiplier, uint64_t random_seed, uint32_t draw_index);
     ACTION logstartroll(uint64_t roll_id, name creator, uint64_t creator_id);
     ACTION loggetrand(uint64_t roll_id, uint32_t result, asset bankroll_change, asset new_bankroll, checksum256 random_value);
+    //Roll whose external bets were changed after it was started. The refund is credited to the creator's payouts
+    ACTION logreject(uint64_t roll_id, name creator, uint64_t creator_id, asset refund);
     //Bankroll increase/ decrease
     ACTION logbrchange(asset change, std::string message, asset new_bankroll);
   
@@ -44,6 +77,13 @@ CONTRACT pinkbankroll : public contract {
       uint32_t max_result;
       name rake_recipient;
       bool paid;
+      uint32_t bet_count;
+      bool external_bets;     //true if the bets are read from the creator's bets table, see forEachBet
+      uint64_t pool_id;       //The pool that the bets are paid in and paid out from. 0 is the WAX pool
+      checksum256 bets_hash;  //sha256 of the creator's bets when the roll was started. Only used for external bets
+      uint32_t draw_count;    //Number of independent results of the roll, see getDrawResult
+      double locked_variance; //Part of the locked_variance of the pool that this roll added when it was started
+      int64_t paid_amount;    //Amount of the pool's token that was paid to start the roll
       
       uint64_t primary_key() const { return roll_id; }
       uint128_t get_creator_and_id() const { return uint128_t{creator.value} << 64 | creator_id; }
@@ -57,7 +97,88 @@ CONTRACT pinkbankroll : public contract {
     rolls_t;
 
     
+    //The bets of all rolls are stored in a single table, keyed by roll_id << 16 | bet_id
+    //so that the bets of a roll are stored next to each other, see getBetKey
+    //The symbol of the amount is the symbol of the roll's pool. The bounds and the multiplier are packed into packed_bet, see packBet
     TABLE betStruct {
+      uint64_t bet_key;
+      name bettor;
+      int64_t amount;
+      uint64_t packed_bet;  //multiplier: bits 0-17, lower_bound: bits 18-37, upper_bound: bits 38-57, draw_index: bits 58-63
+      uint64_t random_seed;
+      
+      uint64_t primary_key() const { return bet_key; }
+      uint64_t get_roll_id() const { return bet_key >> 16; }
+      uint64_t get_bet_id() const { return bet_key & 0xFFFF; }
+      uint32_t get_multiplier() const { return packed_bet & 0x3FFFF; }
+      uint32_t get_lower_bound() const { return (packed_bet >> 18) & 0xFFFFF; }
+      uint32_t get_upper_bound() const { return (packed_bet >> 38) & 0xFFFFF; }
+      uint32_t get_draw_index() const { return packed_bet >> 58; }
+    };
+    typedef multi_index<"packedbets"_n, betStruct> bets_t;
+    
+    //Bets on an arbitrary set of results, see announcemask. They use the same bet keys as the packed bets,
+    //the bet ids of a roll are shared between both tables
+    TABLE maskBetStruct {
+      uint64_t bet_key;
+      name bettor;
+      int64_t amount;
+      uint32_t multiplier;
+      uint32_t draw_index;
+      std::vector<uint64_t> result_mask;  //Bit n - 1 is set if the bet wins with the result n
+      uint64_t random_seed;
+      
+      uint64_t primary_key() const { return bet_key; }
+      uint64_t get_roll_id() const { return bet_key >> 16; }
+      uint64_t get_bet_id() const { return bet_key & 0xFFFF; }
+      bool wins(uint32_t result) const { return (result_mask[(result - 1) >> 6] >> ((result - 1) & 63)) & 1; }
+      
+      uint32_t get_result_count() const {
+        uint32_t count = 0;
+        for (uint64_t word : result_mask) {
+          count += __builtin_popcountll(word);
+        }
+        return count;
+      }
+      
+      //Number of separate ranges of results that the bet wins with
+      uint32_t get_interval_count() const {
+        uint32_t count = 0;
+        uint64_t previous_word = 0;
+        for (uint64_t word : result_mask) {
+          //Counts the set bits whose preceding bit is not set
+          count += __builtin_popcountll(word & ~(word << 1 | previous_word >> 63));
+          previous_word = word;
+        }
+        return count;
+      }
+    };
+    typedef multi_index<"maskbets"_n, maskBetStruct> mask_bets_t;
+    
+    //Rolls as they were stored before bet_count and the fields after it were added, only used to migrate existing rolls with migraterolls
+    //bet_count is only present in rolls that already have the current layout
+    struct legacyRollStruct {
+      uint64_t roll_id;
+      name creator;
+      uint64_t creator_id;
+      uint32_t max_result;
+      name rake_recipient;
+      bool paid;
+      binary_extension<uint32_t> bet_count;
+      
+      uint64_t primary_key() const { return roll_id; }
+      uint128_t get_creator_and_id() const { return uint128_t{creator.value} << 64 | creator_id; }
+      uint64_t get_paid() const { return paid ? 1 : 0; }
+    };
+    typedef multi_index<
+    "rolls"_n,
+    legacyRollStruct,
+    indexed_by<"creatorandid"_n, const_mem_fun<legacyRollStruct, uint128_t, &legacyRollStruct::get_creator_and_id>>,
+    indexed_by<"haspaid"_n, const_mem_fun<legacyRollStruct, uint64_t, &legacyRollStruct::get_paid>>>
+    legacy_rolls_t;
+    
+    //Bets as they were stored before packedbets, with one scope per roll. Only used to migrate existing bets with migraterolls
+    struct legacyBetStruct {
       uint64_t bet_id;
       name bettor;
       asset quantity;
@@ -68,7 +189,92 @@ CONTRACT pinkbankroll : public contract {
       
       uint64_t primary_key() const { return bet_id; }
     };
-    typedef multi_index<"rollbets"_n, betStruct> rollBets_t;
+    typedef multi_index<"rollbets"_n, legacyBetStruct> legacy_bets_t;
+    
+    
+    //Bankroll pools of other tokens than WAX. The WAX pool (pool_id 0) is stored in the stats, see getPool
+    //The shares of each pool are tokens in the token.pink contract, the same as PINK for the WAX pool
+    //Their supply is mirrored in share_supply, which is only changed together with issuing and retiring shares
+    TABLE poolStruct {
+      uint64_t pool_id;
+      name token_contract;
+      asset bankroll;
+      asset share_supply;
+      double locked_variance;  //Sum of the variances of the paid rolls of the pool that are waiting for their result
+      uint32_t paid_rolls;     //Number of these rolls
+      
+      uint64_t primary_key() const { return pool_id; }
+      uint128_t get_token() const { return uint128_t{token_contract.value} << 64 | bankroll.symbol.raw(); }
+      uint64_t get_share_symbol() const { return share_supply.symbol.code().raw(); }
+    };
+    typedef multi_index<
+    "pools"_n,
+    poolStruct,
+    indexed_by<"token"_n, const_mem_fun<poolStruct, uint128_t, &poolStruct::get_token>>,
+    indexed_by<"sharesymbol"_n, const_mem_fun<poolStruct, uint64_t, &poolStruct::get_share_symbol>>>
+    pools_t;
+    
+    
+    //Queued withdrawals, settled in order of their withdrawal_id for each pool, see processWithdrawals
+    TABLE withdrawalStruct {
+      uint64_t withdrawal_id;
+      uint64_t pool_id;
+      name investor;
+      asset shares;
+      
+      uint64_t primary_key() const { return withdrawal_id; }
+      uint128_t get_pool_and_id() const { return uint128_t{pool_id} << 64 | withdrawal_id; }
+    };
+    typedef multi_index<
+    "withdrawals"_n,
+    withdrawalStruct,
+    indexed_by<"poolandid"_n, const_mem_fun<withdrawalStruct, uint128_t, &withdrawalStruct::get_pool_and_id>>>
+    withdrawals_t;
+    
+    
+    //Creators that are allowed to start rolls with bets from their own bets table
+    TABLE extCreatorStruct {
+      name creator;
+      
+      uint64_t primary_key() const { return creator.value; }
+    };
+    typedef multi_index<"extcreators"_n, extCreatorStruct> ext_creators_t;
+    
+    
+    //Other instances of this contract that hold part of the bankroll, see setshard
+    TABLE shardStruct {
+      name account;
+      
+      uint64_t primary_key() const { return account.value; }
+    };
+    typedef multi_index<"shards"_n, shardStruct> shards_t;
+    
+    //Bankroll of the pools of the other shards, as last reported by them, see reportshard. Scoped by the pool_id of this contract
+    //Only used by the instance that issues the shares
+    TABLE shardBankrollStruct {
+      name shard;
+      asset bankroll;
+      
+      uint64_t primary_key() const { return shard.value; }
+    };
+    typedef multi_index<"shardbanks"_n, shardBankrollStruct> shard_bankrolls_t;
+    
+    //Sum of the reported bankrolls of the shards for each pool, so that the share price only needs a single read
+    TABLE shardTotalStruct {
+      uint64_t pool_id;
+      int64_t bankroll;
+      
+      uint64_t primary_key() const { return pool_id; }
+    };
+    typedef multi_index<"shardtotals"_n, shardTotalStruct> shard_totals_t;
+    
+    //The instance that issues the shares, if this contract is one of its shards, see setissuer
+    TABLE shardConfigStruct {
+      name issuer;
+    };
+    typedef singleton<"shardconfig"_n, shardConfigStruct> shard_config_t;
+    // https://github.com/EOSIO/eosio.cdt/issues/280
+    typedef multi_index<"shardconfig"_n, shardConfigStruct> shard_config_t_for_abi;
     
     
     TABLE payoutStruct {
@@ -80,10 +286,26 @@ CONTRACT pinkbankroll : public contract {
     typedef multi_index<"payouts"_n, payoutStruct> payouts_t;
     
     
+    //Rake and dev fees that have been taken from the bankroll but not yet been paid out, see sweepfees
+    TABLE feeStruct {
+      name recipient;
+      asset balance;
+      
+      uint64_t primary_key() const { return recipient.value; }
+    };
+    typedef multi_index<"fees"_n, feeStruct> fees_t;
+    
+    
+    //The fields after paused were added to the existing stats later. They are read with their default values
+    //until the stats are written again. The share supply mirror then needs to be set with syncsupply
     TABLE statsStruct {
       asset bankroll = asset(0, symbol("WAX", 8));
       uint64_t current_roll_id = 0;
       bool paused = false;
+      binary_extension<asset> share_supply = asset(0, symbol("PINK", 4)); //Mirror of the PINK supply, see poolStruct
+      binary_extension<uint64_t> current_withdrawal_id = 0;
+      binary_extension<double> locked_variance = 0.0;  //See poolStruct
+      binary_extension<uint32_t> paid_rolls = 0;
     };
     typedef singleton<"stats"_n, statsStruct> stats_t;
     // https://github.com/EOSIO/eosio.cdt/issues/280
@@ -99,20 +321,132 @@ CONTRACT pinkbankroll : public contract {
     
     
     rolls_t rollsTable;
-    payouts_t payoutsTable;
+    bets_t betsTable;
+    mask_bets_t maskBetsTable;
+    ext_creators_t extCreatorsTable;
+    shards_t shardsTable;
+    shard_totals_t shardTotalsTable;
+    shard_config_t shardConfigTable;
+    pools_t poolsTable;
+    withdrawals_t withdrawalsTable;
     stats_t statsTable;
     signvals_table_type signvals_table;
+    
+    //Per action copy of the stats singleton, see getStats and modifyStats
+    statsStruct statsCache;
+    bool statsLoaded = false;
+    bool statsDirty = false;
+    //Per action copy of the last used pool, see getPool and modifyPool
+    poolStruct poolCache;
+    bool poolLoaded = false;
+    bool poolDirty = false;
   
-    void transferFromBankroll(name recipient, asset quantity, std::string memo);
-    void handleDeposit(name investor, asset quantity);
-    void handleStartRoll(name creator, uint64_t creator_id, asset quantity);
+    const statsStruct& getStats();
+    statsStruct& modifyStats();
+    const poolStruct& getPool(uint64_t pool_id);
+    poolStruct& modifyPool(uint64_t pool_id);
+    void flushPool();
+    payouts_t getPayoutsTable(uint64_t pool_id);
+    fees_t getFeesTable(uint64_t pool_id);
+    void createRoll(name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient, bool external_bets, uint64_t pool_id);
+    void addBet(name creator, uint64_t creator_id, name bettor, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t random_seed, uint32_t draw_index);
+    rollStruct reserveBet(name creator, uint64_t creator_id, asset quantity, uint32_t draw_index);
+    void eraseRollBets(uint64_t roll_id);
+    void unlockRoll(const rollStruct& roll);
+    void creditPayout(payouts_t& payoutsTable, name recipient, asset quantity);
+    void payoutFromPool(name from, uint64_t pool_id, asset quantity);
+    void transferFromBankroll(uint64_t pool_id, name recipient, asset quantity, std::string memo);
+    void accrueFee(uint64_t pool_id, name recipient, asset quantity);
+    void handleTransfer(uint64_t pool_id, name from, asset quantity, std::string memo);
+    void handleDeposit(uint64_t pool_id, name investor, asset quantity);
+    uint32_t processWithdrawals(uint64_t pool_id, uint32_t max_count);
+    void handleStartRoll(uint64_t pool_id, name creator, uint64_t creator_id, asset quantity);
+    double getRollVariance(const rollStruct& roll, std::vector<uint64_t>& total_bets_collected, std::vector<uint32_t>& bet_counts);
     bool isPaused();
+    int64_t getTotalBankroll(const poolStruct& pool);
+    bool isShareIssuer();
+    void reportBankroll(uint64_t pool_id);
+    void setShardBankroll(uint64_t pool_id, name shard, int64_t amount);
+    static uint64_t getBetKey(uint64_t roll_id, uint64_t bet_id);
+    static uint64_t packBet(uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint32_t draw_index);
+    static uint32_t getDrawResult(checksum256 random_value, uint32_t draw_index, uint32_t max_result);
+    
+    
+    /**
+     * Calls handle_bet for every bet of a roll
+     * The bets of rolls with external bets are read from the creator's bets table, which has to use the same
+     * layout and key (creator_id << 16 | bet_id) as the bets table of this contract. Otherwise the bets of this contract are used
+     * 
+     * @param roll - The roll to iterate the bets of
+     * @param handle_bet - Function that is called with each bet (const betStruct&)
+     */
+    template<typename F>
+    void forEachBet(const rollStruct& roll, F handle_bet) {
+      if (roll.external_bets) {
+        bets_t externalBetsTable(roll.creator, roll.creator.value);
+        for (auto bet_itr = externalBetsTable.lower_bound(getBetKey(roll.creator_id, 0)); bet_itr != externalBetsTable.end() && bet_itr->get_roll_id() == roll.creator_id; bet_itr++) {
+          handle_bet(*bet_itr);
+        }
+      } else {
+        for (auto bet_itr = betsTable.lower_bound(getBetKey(roll.roll_id, 0)); bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll.roll_id; bet_itr++) {
+          handle_bet(*bet_itr);
+        }
+      }
+    }
+    
+    
+    /**
+     * Calls handle_bet for every mask bet of a roll
+     * Mask bets can only be added with announcemask, so rolls with external bets never have any
+     * 
+     * @param roll - The roll to iterate the mask bets of
+     * @param handle_bet - Function that is called with each mask bet (const maskBetStruct&)
+     */
+    template<typename F>
+    void forEachMaskBet(const rollStruct& roll, F handle_bet) {
+      for (auto bet_itr = maskBetsTable.lower_bound(getBetKey(roll.roll_id, 0)); bet_itr != maskBetsTable.end() && bet_itr->get_roll_id() == roll.roll_id; bet_itr++) {
+        handle_bet(*bet_itr);
+      }
+    }
+    
+    
+    /**
+     * Calls handle_interval for every range of consecutive results that a mask bet wins with, in ascending order
+     * This lets the ranges of the required bankroll be built from mask bets the same way as from ordinary bets
+     * 
+     * @param bet - The mask bet to split into ranges
+     * @param handle_interval - Function that is called with the lower and upper bound of each range (uint32_t, uint32_t)
+     */
+    template<typename F>
+    static void forEachInterval(const maskBetStruct& bet, F handle_interval) {
+      uint32_t lower_bound = 0;
+      for (uint32_t word_index = 0; word_index < bet.result_mask.size(); word_index++) {
+        uint64_t word = bet.result_mask[word_index];
+        //Words that neither start nor end a range can be skipped
+        if (word == (lower_bound == 0 ? 0 : ~uint64_t(0))) {
+          continue;
+        }
+        for (uint32_t bit = 0; bit < 64; bit++) {
+          uint32_t result = word_index * 64 + bit + 1;
+          bool wins = (word >> bit) & 1;
+          if (wins && lower_bound == 0) {
+            lower_bound = result;
+          } else if (!wins && lower_bound != 0) {
+            handle_interval(lower_bound, result - 1);
+            lower_bound = 0;
+          }
+        }
+      }
+      if (lower_bound != 0) {
+        handle_interval(lower_bound, (uint32_t)bet.result_mask.size() * 64);
+      }
+    }
     
     
     /**
      * The following code is taken from the eosio.token contract
      * https://github.com/EOSIO/eosio.contracts/blob/master/contracts/eosio.token
-     * It is needed to get the supply from the token.pink contract
+     * It is needed to get the supply from the token.pink contract when syncing the share supply mirrors
      * /
     
     
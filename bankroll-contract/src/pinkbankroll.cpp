@@ -3,6 +3,15 @@
 
 static constexpr symbol CORE_SYMBOL = symbol("WAX", 8);
 static constexpr symbol PINK_SYMBOL = symbol("PINK", 4);
+//Max number of queued withdrawals that are settled after each roll result
+static constexpr uint32_t MAX_WITHDRAWALS_PER_RESULT = 5;
+//Limits of the fields in the packed bets, see betStruct
+static constexpr uint32_t MAX_PACKED_BOUND = 0xFFFFF;
+static constexpr uint32_t MAX_PACKED_MULTIPLIER = 0x3FFFF;
+//The draw index is stored in the 6 remaining bits of the packed bets
+static constexpr uint32_t MAX_DRAW_COUNT = 64;
+//Max result of rolls that mask bets can be added to, which limits a result mask to 16 words
+static constexpr uint32_t MAX_MASK_RESULT = 1024;
 
 //Only needs to be called once after contract creation
 ACTION pinkbankroll::init() {
@@ -22,6 +31,63 @@ ACTION pinkbankroll::init() {
  * @param rake_recipient - The name of the account that will receive the rake payment for this roll
  */
 ACTION pinkbankroll::announceroll(name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient) {
+  createRoll(creator, creator_id, max_result, rake_recipient, false, 0);
+}
+
+
+
+
+/**
+ * Alternative to announceroll for registered external creators (see setextcreator)
+ * No bets are announced for these rolls. Instead, the bets are read directly from the creator's bets table,
+ * which has to have the same layout as the bets table of this contract, scoped to the creator and keyed by creator_id << 16 | bet_id.
+ * The bets are committed to with a hash when the roll is started, and must not be changed by the creator until the result has been sent
+ * Registered creators are trusted to only store bets that would also be accepted by announcebet
+ * 
+ * @param creator - The name of the creator of this roll. Only this account will be able to start the roll
+ * @param creator_id - A unique id that the creator uses to identify this roll. Also the roll id of the bets in the creator's bets table
+ * @param max_result - The roll will produce a result 1 <= result <= max_result that can be bet Only
+ * @param rake_recipient - The name of the account that will receive the rake payment for this roll
+ */
+ACTION pinkbankroll::announceext(name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient) {
+  check(extCreatorsTable.find(creator.value) != extCreatorsTable.end(),
+  "the creator is not registered to use external bets");
+  check(creator_id <= 0xFFFFFFFFFFFF,
+  "the creator_id of rolls with external bets must be smaller than 2^48");
+  
+  createRoll(creator, creator_id, max_result, rake_recipient, true, 0);
+}
+
+
+
+
+/**
+ * Alternative to announceroll for rolls that are paid in and paid out from another pool than the WAX pool (see addpool)
+ * 
+ * @param creator - The name of the creator of this roll. Only this account will be able to add bets and start the roll
+ * @param creator_id - A unique id that the creator uses to identify this roll. This is different from the internal roll_id
+ * @param max_result - The roll will produce a result 1 <= result <= max_result that can be bet Only
+ * @param rake_recipient - The name of the account that will receive the rake payment for this roll
+ * @param pool_id - The id of the pool of the roll
+ */
+ACTION pinkbankroll::announcepool(name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient, uint64_t pool_id) {
+  createRoll(creator, creator_id, max_result, rake_recipient, false, pool_id);
+}
+
+
+
+
+/**
+ * Private function to create a new roll, used by announceroll, announceext and announcepool
+ * 
+ * @param creator - The name of the creator of this roll
+ * @param creator_id - A unique id that the creator uses to identify this roll
+ * @param max_result - The roll will produce a result 1 <= result <= max_result
+ * @param rake_recipient - The name of the account that will receive the rake payment for this roll
+ * @param external_bets - Whether the bets of the roll are read from the creator's bets table
+ * @param pool_id - The id of the pool of the roll
+ */
+void pinkbankroll::createRoll(name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient, bool external_bets, uint64_t pool_id) {
   check(!isPaused(),
   "the contract is paused, only withdrawals and payouts are currently allowed");
   
@@ -29,6 +95,8 @@ ACTION pinkbankroll::announceroll(name creator, uint64_t creator_id, uint32_t ma
   
   check(max_result != 0,
   "max result can't be 0");
+  check(max_result <= MAX_PACKED_BOUND,
+  "max result can't be greater than 1048575");
   
   uint128_t creator_and_id = uint128_t{creator.value} << 64 | creator_id;
   auto rolls_by_creator_and_id = rollsTable.get_index<"creatorandid"_n>();
@@ -37,10 +105,11 @@ ACTION pinkbankroll::announceroll(name creator, uint64_t creator_id, uint32_t ma
   check(itr_creator_and_id == rolls_by_creator_and_id.end(),
   "can't create a roll with a creator_id that is already in use");
   
+  //Fails if the pool doesn't exist
+  getPool(pool_id);
+  
   //available_primary_key can't be used, because finished rolls are deleted from the table
-  statsStruct stats = statsTable.get();
-  uint64_t roll_id = stats.current_roll_id++;
-  statsTable.set(stats, _self);
+  uint64_t roll_id = modifyStats().current_roll_id++;
   
   rollsTable.emplace(creator, [&](rollStruct &r) {
     r.roll_id = roll_id;
@@ -48,6 +117,13 @@ ACTION pinkbankroll::announceroll(name creator, uint64_t creator_id, uint32_t ma
     r.creator_id = creator_id;
     r.max_result = max_result;
     r.rake_recipient = rake_recipient;
+    r.paid = false;
+    r.bet_count = 0;
+    r.external_bets = external_bets;
+    r.pool_id = pool_id;
+    r.draw_count = 1;
+    r.locked_variance = 0;
+    r.paid_amount = 0;
   });
   
   action(
@@ -62,22 +138,15 @@ ACTION pinkbankroll::announceroll(name creator, uint64_t creator_id, uint32_t ma
 
 
 /**
- * Adds a bet to an existing roll. The bet is not paid for immediately, instead all bets are paid for at once when starting the roll.
+ * Sets the number of draws of a roll. Every draw has its own independent result, but all of them are derived from the same
+ * random value, so a roll with multiple draws only needs a single request to the rng oracle
+ * Bets can target a specific draw with the announcedraw action. Can only be called before any bets are added to the roll
  * 
- * @param creator - The name of the creator of the roll to add this bet to. Only the creator can add bets to his own rolls
- * @param creator_id - The unique id of the roll that the creator specified in the announceroll action
- * @param bettor - The name of the bettor. This account will receive the payout if this bet wins
- * @param quantity - The quantity of WAX to be wagered
- * @param lower_bound - The lower bound of the range to bet on
- * @param upper_bound - The upper bound of the range to bet on
- * @param multiplier - The multiplier of this bet x 1000 (multiplier = 2000 -> 2x payout)
- * @param random_seed - The random_seed that will be included in the seed that will later be sent to the rng oracle.
- *                      Users are highly encouraged to send actual (pseudo) random values here to avoid later collisions in the rng oracle
+ * @param creator - The name of the creator of the roll
+ * @param creator_id - The unique id of the roll that the creator specified when announcing the roll
+ * @param draw_count - The number of draws of the roll (1 <= draw_count <= 64)
  */
-ACTION pinkbankroll::announcebet(name creator, uint64_t creator_id, name bettor, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t random_seed) {
-  check(!isPaused(),
-  "the contract is paused, only withdrawals and payouts are currently allowed");
-  
+ACTION pinkbankroll::setdraws(name creator, uint64_t creator_id, uint32_t draw_count) {
   require_auth(creator);
   
   uint128_t creator_and_id = uint128_t{creator.value} << 64 | creator_id;
@@ -86,44 +155,99 @@ ACTION pinkbankroll::announcebet(name creator, uint64_t creator_id, name bettor,
   
   check(itr_creator_and_id != rolls_by_creator_and_id.end(),
   "No bet with the specified creator_id has been announced");
-  
   check(!itr_creator_and_id->paid,
   "the roll has already been paid for");
+  check(itr_creator_and_id->bet_count == 0,
+  "the draw count can only be changed before bets are added to the roll");
   
-  check(quantity.is_valid(),
-  "quantity is invalid");
-  check(quantity.symbol == CORE_SYMBOL,
-  "quantity must be in WAX");
+  check(draw_count >= 1,
+  "the draw count needs to be at least 1");
+  check(draw_count <= MAX_DRAW_COUNT,
+  "the draw count can't be greater than 64");
+  
+  rolls_by_creator_and_id.modify(itr_creator_and_id, same_payer, [&](auto &r) {
+    r.draw_count = draw_count;
+  });
+}
+
+
+
+
+/**
+ * Adds a bet to an existing roll. The bet is not paid for immediately, instead all bets are paid for at once when starting the roll.
+ * 
+ * @param creator - The name of the creator of the roll to add this bet to. Only the creator can add bets to his own rolls
+ * @param creator_id - The unique id of the roll that the creator specified in the announceroll action
+ * @param bettor - The name of the bettor. This account will receive the payout if this bet wins
+ * @param quantity - The quantity of WAX to be wagered
+ * @param lower_bound - The lower bound of the range to bet on
+ * @param upper_bound - The upper bound of the range to bet on
+ * @param multiplier - The multiplier of this bet x 1000 (multiplier = 2000 -> 2x payout)
+ * @param random_seed - The random_seed that will be included in the seed that will later be sent to the rng oracle.
+ *                      Users are highly encouraged to send actual (pseudo) random values here to avoid later collisions in the rng oracle
+ */
+ACTION pinkbankroll::announcebet(name creator, uint64_t creator_id, name bettor, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t random_seed) {
+  addBet(creator, creator_id, bettor, quantity, lower_bound, upper_bound, multiplier, random_seed, 0);
+}
+
+
+
+
+/**
+ * Adds a bet to a specific draw of an existing roll. The bet only wins if the result of this draw is within its bounds
+ * Apart from that, this is the same as announcebet
+ * 
+ * @param creator - The name of the creator of the roll to add this bet to. Only the creator can add bets to his own rolls
+ * @param creator_id - The unique id of the roll that the creator specified in the announceroll action
+ * @param bettor - The name of the bettor. This account will receive the payout if this bet wins
+ * @param quantity - The quantity of WAX to be wagered
+ * @param lower_bound - The lower bound of the range to bet on
+ * @param upper_bound - The upper bound of the range to bet on
+ * @param multiplier - The multiplier of this bet x 1000 (multiplier = 2000 -> 2x payout)
+ * @param random_seed - The random_seed that will be included in the seed that will later be sent to the rng oracle.
+ * @param draw_index - The index of the draw to bet on. Needs to be smaller than the draw count of the roll, see setdraws
+ */
+ACTION pinkbankroll::announcedraw(name creator, uint64_t creator_id, name bettor, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t random_seed, uint32_t draw_index) {
+  addBet(creator, creator_id, bettor, quantity, lower_bound, upper_bound, multiplier, random_seed, draw_index);
+}
+
+
+
+
+/**
+ * Private function to add a bet to a roll, used by announcebet and announcedraw
+ * 
+ * @param draw_index - The index of the draw that the bet is on. For the other parameters, see announcedraw
+ */
+void pinkbankroll::addBet(name creator, uint64_t creator_id, name bettor, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t random_seed, uint32_t draw_index) {
+  rollStruct roll = reserveBet(creator, creator_id, quantity, draw_index);
   
   check(lower_bound >= 1,
   "lower_bound needs to be at least 1");
   check(lower_bound <= upper_bound,
   "lower_bound can't be greater than upper_bound");
-  check(upper_bound <= itr_creator_and_id->max_result,
+  check(upper_bound <= roll.max_result,
   "upper_bound can't be greater than the max_result of the roll");
   
   check(multiplier > 1000,
   "the multiplier has to be greater than 1000 (greater than 1x)");
   
   
-  double odds = (double)(upper_bound - lower_bound + 1) / (double)(itr_creator_and_id->max_result);
+  double odds = (double)(upper_bound - lower_bound + 1) / (double)(roll.max_result);
   check (odds >= 0.005,
   "the odds cant be smaller than 0.005");
   double ev = odds * multiplier / 1000.0;
   check(ev <= 0.99,
   "the bet cant have an EV greater than 0.99 * quantity");
   
-  uint64_t roll_id = itr_creator_and_id->roll_id;
+  uint64_t roll_id = roll.roll_id;
+  uint64_t bet_id = roll.bet_count - 1;
   
-  rollBets_t betsTable(_self, roll_id);
-  uint64_t bet_id = betsTable.available_primary_key();
   betsTable.emplace(creator, [&](betStruct &b) {
-    b.bet_id = bet_id;
+    b.bet_key = getBetKey(roll_id, bet_id);
     b.bettor = bettor;
-    b.quantity = quantity;
-    b.lower_bound = lower_bound;
-    b.upper_bound = upper_bound;
-    b.multiplier = multiplier;
+    b.amount = quantity.amount;
+    b.packed_bet = packBet(lower_bound, upper_bound, multiplier, draw_index);
     b.random_seed = random_seed;
   });
   
@@ -138,6 +262,112 @@ ACTION pinkbankroll::announcebet(name creator, uint64_t creator_id, name bettor,
 
 
 
+/**
+ * Adds a bet on an arbitrary set of results to an existing roll, e.g. on all red numbers of a roulette roll
+ * The set is a bitmask over the results, so the bet needs a single row no matter how many ranges it covers
+ * Apart from that, this is the same as announcedraw
+ * 
+ * @param creator - The name of the creator of the roll to add this bet to. Only the creator can add bets to his own rolls
+ * @param creator_id - The unique id of the roll that the creator specified in the announceroll action
+ * @param bettor - The name of the bettor. This account will receive the payout if this bet wins
+ * @param quantity - The quantity of WAX to be wagered
+ * @param result_mask - The results to bet on. Bit n - 1 (bit (n - 1) % 64 of word (n - 1) / 64) is set if the bet wins with the result n
+ *                      Needs exactly one bit for every result, so the roll can have a max_result of at most 1024
+ * @param multiplier - The multiplier of this bet x 1000 (multiplier = 2000 -> 2x payout)
+ * @param random_seed - The random_seed that will be included in the seed that will later be sent to the rng oracle.
+ * @param draw_index - The index of the draw to bet on. Needs to be smaller than the draw count of the roll, see setdraws
+ */
+ACTION pinkbankroll::announcemask(name creator, uint64_t creator_id, name bettor, asset quantity, std::vector<uint64_t> result_mask, uint32_t multiplier, uint64_t random_seed, uint32_t draw_index) {
+  rollStruct roll = reserveBet(creator, creator_id, quantity, draw_index);
+  
+  check(roll.max_result <= MAX_MASK_RESULT,
+  "mask bets can only be added to rolls with a max_result of up to 1024");
+  check(result_mask.size() == (roll.max_result + 63) / 64,
+  "the result mask needs exactly one bit for every result of the roll");
+  uint32_t unused_bits = result_mask.size() * 64 - roll.max_result;
+  check(unused_bits == 0 || result_mask.back() >> (64 - unused_bits) == 0,
+  "the result mask can't contain results greater than the max_result of the roll");
+  
+  check(multiplier > 1000,
+  "the multiplier has to be greater than 1000 (greater than 1x)");
+  
+  maskBetStruct bet;
+  bet.result_mask = result_mask;
+  
+  double odds = (double)bet.get_result_count() / (double)(roll.max_result);
+  check (odds >= 0.005,
+  "the odds cant be smaller than 0.005");
+  double ev = odds * multiplier / 1000.0;
+  check(ev <= 0.99,
+  "the bet cant have an EV greater than 0.99 * quantity");
+  
+  uint64_t roll_id = roll.roll_id;
+  uint64_t bet_id = roll.bet_count - 1;
+  
+  maskBetsTable.emplace(creator, [&](maskBetStruct &b) {
+    b.bet_key = getBetKey(roll_id, bet_id);
+    b.bettor = bettor;
+    b.amount = quantity.amount;
+    b.multiplier = multiplier;
+    b.draw_index = draw_index;
+    b.result_mask = result_mask;
+    b.random_seed = random_seed;
+  });
+  
+  action(
+    permission_level{_self, "active"_n},
+    _self,
+    "logmaskbet"_n,
+    std::make_tuple(roll_id, bet_id, bettor, quantity, result_mask, multiplier, random_seed, draw_index)
+  ).send();
+}
+
+
+
+
+/**
+ * Private function to check that a bet can be added to a roll and to give it the next bet id of the roll
+ * Used by addBet and announcemask, which check and store the bet itself
+ * 
+ * @param draw_index - The index of the draw that the bet is on. For the other parameters, see announcedraw
+ * @return - The roll after counting the bet. The id of the bet is bet_count - 1
+ */
+pinkbankroll::rollStruct pinkbankroll::reserveBet(name creator, uint64_t creator_id, asset quantity, uint32_t draw_index) {
+  check(!isPaused(),
+  "the contract is paused, only withdrawals and payouts are currently allowed");
+  
+  require_auth(creator);
+  
+  uint128_t creator_and_id = uint128_t{creator.value} << 64 | creator_id;
+  auto rolls_by_creator_and_id = rollsTable.get_index<"creatorandid"_n>();
+  auto itr_creator_and_id = rolls_by_creator_and_id.find(creator_and_id);
+  
+  check(itr_creator_and_id != rolls_by_creator_and_id.end(),
+  "No bet with the specified creator_id has been announced");
+  
+  check(!itr_creator_and_id->paid,
+  "the roll has already been paid for");
+  check(!itr_creator_and_id->external_bets,
+  "bets of rolls with external bets are read from the creator's bets table");
+  
+  check(quantity.is_valid(),
+  "quantity is invalid");
+  check(quantity.symbol == getPool(itr_creator_and_id->pool_id).bankroll.symbol,
+  "quantity must be in the token of the roll's pool");
+  
+  check(draw_index < itr_creator_and_id->draw_count,
+  "the draw index has to be smaller than the draw count of the roll");
+  
+  check(itr_creator_and_id->bet_count <= 0xFFFF,
+  "a roll can't have more than 65536 bets");
+  
+  rolls_by_creator_and_id.modify(itr_creator_and_id, same_payer, [&](auto &r) {
+    r.bet_count += 1;
+  });
+  
+  return *itr_creator_and_id;
+}
+
 /**
  * Pays out a winning bet. Usually, this is called by an automatic deferred action when the result of a roll is handled.
  * However, since this deferred action could theoretically fail, users are also able to withdraw their outstanding bets manually
@@ -146,12 +376,41 @@ ACTION pinkbankroll::announcebet(name creator, uint64_t creator_id, name bettor,
  * @param quantity - The amount of WAX to payout
  */
 ACTION pinkbankroll::payoutbet(name from, asset quantity) {
+  payoutFromPool(from, 0, quantity);
+}
+
+
+
+
+/**
+ * The same as payoutbet, for bets of rolls in other pools than the WAX pool
+ * 
+ * @param from - The account name to payout a bet to
+ * @param pool_id - The id of the pool the bet was paid out from
+ * @param quantity - The amount of the pool's token to payout
+ */
+ACTION pinkbankroll::poolpayout(name from, uint64_t pool_id, asset quantity) {
+  payoutFromPool(from, pool_id, quantity);
+}
+
+
+
+
+/**
+ * Private function to pay out outstanding payouts of a pool, used by payoutbet and poolpayout
+ * 
+ * @param from - The account name to payout a bet to
+ * @param pool_id - The id of the pool the bet was paid out from
+ * @param quantity - The amount to payout
+ */
+void pinkbankroll::payoutFromPool(name from, uint64_t pool_id, asset quantity) {
   
   check(quantity.is_valid(),
   "quantity is invalid");
-  check(quantity.symbol == CORE_SYMBOL,
-  "quantity must be in WAX");
+  check(quantity.symbol == getPool(pool_id).bankroll.symbol,
+  "quantity must be in the token of the pool");
   
+  payouts_t payoutsTable = getPayoutsTable(pool_id);
   auto payout_itr = payoutsTable.find(from.value);
   check(payout_itr != payoutsTable.end(),
   "the account has no outstanding payouts");
@@ -171,7 +430,7 @@ ACTION pinkbankroll::payoutbet(name from, asset quantity) {
   //when the payout has been added to the payouts table
   action(
     permission_level{_self, "active"_n},
-    "eosio.token"_n,
+    getPool(pool_id).token_contract,
     "transfer"_n,
     std::make_tuple(_self, from, quantity, std::string("bet payout"))
   ).send();
@@ -190,138 +449,573 @@ ACTION pinkbankroll::payoutbet(name from, asset quantity) {
  */
 ACTION pinkbankroll::setpaused(bool paused) {
   require_auth("pinknetworkx"_n);
-  statsStruct stats = statsTable.get();
-  stats.paused = paused;
-  statsTable.set(stats, _self);
+  modifyStats().paused = paused;
 }
 
 
 
 
 /**
- * This is called by the RNG oracle, providing the randomness for calculating the result
- * Note: In the case there are a lot (>100) bets that are all being paid out, this action could theoretically take more than 30ms to execute
- *       If that is the case, the transaction will fail. Depending on the functionality of the oracle, the transaction might be resent.
- *       It is the responsibility of the 3rd party dev using the pinkbankroll contract to ensure that this doesn't happen by enforcing an appropiate max bet limit
+ * @dev Can be called by the dev account to allow/ disallow a creator to use rolls with external bets (see announceext)
  * 
- * @param assoc_id - The assoc_id that was provided to the oracle when requesting the random value. Equal to the roll_id
- * @param random_value - The sha256 hash of the random seed that was provided when starting the roll. Is used as randomness
+ * @param creator - The account name of the creator
+ * @param registered - Whether the creator is allowed to use external bets
  */
-ACTION pinkbankroll::receiverand(uint64_t assoc_id, checksum256 random_value) {
-  require_auth("orng.wax"_n);
-  
-  auto rolls_itr = rollsTable.find(assoc_id);
-  check(rolls_itr != rollsTable.end(),
-  "no bet with this id exists");
-  check(rolls_itr->paid,
-  "this roll has not been paid for yet");
-  
-  name roll_creator = rolls_itr->creator;
-  uint64_t roll_creator_id = rolls_itr->creator_id;
-  
-  
-  const auto random_array = random_value.get_array();
-  //The first 128 bits of the random_value. The rest is not needed
-  uint128_t random_number = random_array[0];
-  
-  uint32_t result = (random_number % rolls_itr->max_result) + 1;
-  print("Result: ", result, " / ", rolls_itr->max_result);
-  
-  rollBets_t betsTable(_self, assoc_id);
-  
-  asset total_rake = asset(0, CORE_SYMBOL);
-  asset total_dev_fee = asset(0, CORE_SYMBOL);
-  asset bankroll_change = asset(0, CORE_SYMBOL); //Disregarding rake/ fee
+ACTION pinkbankroll::setextcreator(name creator, bool registered) {
+  require_auth("pinknetworkx"_n);
   
-  auto bet_itr = betsTable.begin();
-  while(bet_itr != betsTable.end()) {
-    //Calculating the rake/ fee to payouts
-    double ev = (double)bet_itr->multiplier / 1000.0 * (double)(bet_itr->upper_bound - bet_itr->lower_bound + 1) / (double)rolls_itr->max_result;
-    double edge = 1.0 - ev;
-    total_rake.amount += (int64_t)((double)bet_itr->quantity.amount * (edge - 0.01));
-    total_dev_fee.amount += (int64_t)((double)bet_itr->quantity.amount * 0.003);
-    
-    //Calculating the bet outcome
-    bankroll_change += bet_itr->quantity;
-    
-    if (bet_itr->lower_bound <= result && result <= bet_itr->upper_bound) {
-      //This bet won
-      asset quantity_won = bet_itr->quantity * bet_itr->multiplier / 1000;
-      bankroll_change -= quantity_won;
-      
-      //Updating payouts table
-      auto payouts_itr = payoutsTable.find(bet_itr->bettor.value);
-      if (payouts_itr != payoutsTable.end()) {
-        payoutsTable.modify(payouts_itr, _self, [&](auto& p) {
-          p.outstanding_payout += quantity_won;
-        });
-      } else {
-        payoutsTable.emplace(_self, [&](auto& p){
-          p.bettor = bet_itr->bettor;
-          p.outstanding_payout = quantity_won;
-        });
-      }
-      
-      //Deferred transactions have to be used in order to guarantee that no single bet can make the whole payout throw
-      //They are however not 100% guaranteed to go through. Therefore, users can also manually withdraw their bets with the payoutbet action
-      
-      eosio::transaction t;
-      t.actions.emplace_back(
-        permission_level(_self, "active"_n),
-        _self,
-        "payoutbet"_n,
-        std::make_tuple(bet_itr->bettor, quantity_won)
-      );
-      
-      uint64_t deferred_id = (assoc_id << 16) + bet_itr->bet_id;
-      t.send(deferred_id, _self);
-      
-    }
-    
-    
-    //Removing bet table entry
-    //erase returns iterator poiting to next entry
-    bet_itr = betsTable.erase(bet_itr);
+  auto creator_itr = extCreatorsTable.find(creator.value);
+  if (registered && creator_itr == extCreatorsTable.end()) {
+    extCreatorsTable.emplace(_self, [&](auto& c) {
+      c.creator = creator;
+    });
+  } else if (!registered && creator_itr != extCreatorsTable.end()) {
+    extCreatorsTable.erase(creator_itr);
   }
-  
-  statsStruct stats = statsTable.get();
-  stats.bankroll += bankroll_change;
-  statsTable.set(stats, _self);
-  
-  //Removing roll table entry
-  rollsTable.erase(rolls_itr);
-  
-  action(
-    permission_level{_self, "active"_n},
-    _self,
-    "logbrchange"_n,
-    std::make_tuple(bankroll_change, std::string("roll result"), stats.bankroll)
-  ).send();
-  
-  transferFromBankroll(rolls_itr->rake_recipient, total_rake, std::string("pinkbankroll rake"));
-  transferFromBankroll("pinknetworkx"_n, total_dev_fee, std::string("pinkbankroll devfee"));
-  
-  action(
-    permission_level{_self, "active"_n},
-    _self,
-    "loggetrand"_n,
-    std::make_tuple(assoc_id, result, bankroll_change - total_rake - total_dev_fee, stats.bankroll, random_value)
-  ).send();
-  
-  action(
-    permission_level{_self, "active"_n},
-    _self,
-    "notifyresult"_n,
-    std::make_tuple(roll_creator, roll_creator_id, result)
-  ).send();
 }
 
 
 
 
 /**
- * This is called whenever there is a eosio.token transfer involving pinkbankroll as either sender or recipient
- * It is used to handle deposits to the bankroll, as well as to start rolls_itr
+ * @dev Can be called by the dev account to register/ unregister a shard
+ * Shards are other accounts running this contract that hold part of the bankroll, so that rolls don't all contend on the rows of one account.
+ * The shares are only issued and retired by the instance that is the issuer of the share tokens, so only it accepts deposits and withdrawals.
+ * The other shards register it and set it as their issuer (see setissuer), and it prices the shares with the bankroll they report to it
+ * 
+ * @param account - The account name of the shard
+ * @param registered - Whether the account is a shard
+ */
+ACTION pinkbankroll::setshard(name account, bool registered) {
+  require_auth("pinknetworkx"_n);
+  
+  auto shard_itr = shardsTable.find(account.value);
+  if (registered && shard_itr == shardsTable.end()) {
+    check(account != _self,
+    "the contract can't be a shard of itself");
+    shardsTable.emplace(_self, [&](auto& s) {
+      s.account = account;
+    });
+  } else if (!registered && shard_itr != shardsTable.end()) {
+    check(shardConfigTable.get_or_default().issuer != account,
+    "the issuer of this contract can't be removed");
+    shardsTable.erase(shard_itr);
+    
+    //The bankroll of the shard no longer counts towards the share price
+    setShardBankroll(0, account, 0);
+    for (auto pool_itr = poolsTable.begin(); pool_itr != poolsTable.end(); pool_itr++) {
+      setShardBankroll(pool_itr->pool_id, account, 0);
+    }
+  }
+}
+
+
+
+
+/**
+ * @dev Can be called by the dev account to move bankroll of a pool to another shard, e.g. to the issuing instance to settle withdrawals
+ * The bankroll is sent with the #rebalance memo and added to the bankroll of the same pool there, so the share price doesn't change
+ * 
+ * @param shard - The account name of the shard to move the bankroll to
+ * @param pool_id - The id of the pool to move bankroll from
+ * @param quantity - The quantity to move
+ */
+ACTION pinkbankroll::rebalance(name shard, uint64_t pool_id, asset quantity) {
+  require_auth("pinknetworkx"_n);
+  
+  check(shardsTable.find(shard.value) != shardsTable.end(),
+  "the recipient is not a registered shard");
+  
+  const poolStruct& pool = getPool(pool_id);
+  check(quantity.is_valid() && quantity.amount > 0,
+  "quantity is invalid");
+  check(quantity.symbol == pool.bankroll.symbol,
+  "quantity must be in the token of the pool");
+  //The remaining bankroll still has to accept the rolls that are waiting for their result
+  check(pool.bankroll.amount - quantity.amount >= (int64_t)getRequiredBankrollFromVariance(pool.locked_variance),
+  "the bankroll is locked by active rolls");
+  
+  transferFromBankroll(pool_id, shard, quantity, std::string("#rebalance"));
+  reportBankroll(pool_id);
+}
+
+
+
+
+/**
+ * @dev Can be called by the dev account to set the instance that issues the shares, when this contract is one of its shards
+ * Only the issuing instance accepts deposits and withdrawals. The other shards report their bankroll to it, see syncbankroll
+ * 
+ * @param issuer - The account name of the issuing instance, or an empty name if this contract issues the shares itself
+ */
+ACTION pinkbankroll::setissuer(name issuer) {
+  require_auth("pinknetworkx"_n);
+  
+  check(issuer == name() || shardsTable.find(issuer.value) != shardsTable.end(),
+  "the issuer has to be a registered shard");
+  shardConfigTable.set(shardConfigStruct{issuer}, _self);
+}
+
+
+
+
+/**
+ * Reports the bankroll of a pool of this shard to the issuing instance, which prices the shares with it, see reportshard
+ * Can be called by anyone. The bankroll is reported automatically when it is rebalanced, but it also changes with every roll result,
+ * so this should be called regularly
+ * 
+ * @param pool_id - The id of the pool
+ */
+ACTION pinkbankroll::syncbankroll(uint64_t pool_id) {
+  check(!isShareIssuer(),
+  "this contract issues the shares itself, see setissuer");
+  reportBankroll(pool_id);
+}
+
+
+
+
+/**
+ * Called by a shard of this contract to report the bankroll of one of its pools, see syncbankroll
+ * The reported bankrolls are mirrored, so that the share price doesn't need to read the tables of the shards
+ * The pools of the shards are found by their token, since their pool ids can differ
+ * 
+ * @param shard - The account name of the shard
+ * @param token_contract - The token contract of the pool
+ * @param bankroll - The bankroll of the pool on the shard
+ */
+ACTION pinkbankroll::reportshard(name shard, name token_contract, asset bankroll) {
+  require_auth(shard);
+  check(isShareIssuer(),
+  "only the contract that issues the shares mirrors the bankroll of its shards");
+  check(shardsTable.find(shard.value) != shardsTable.end(),
+  "only registered shards can report their bankroll");
+  
+  uint64_t pool_id = 0;
+  if (!(token_contract == "eosio.token"_n && bankroll.symbol == CORE_SYMBOL)) {
+    auto pools_by_token = poolsTable.get_index<"token"_n>();
+    auto pool_itr = pools_by_token.find(uint128_t{token_contract.value} << 64 | bankroll.symbol.raw());
+    check(pool_itr != pools_by_token.end(),
+    "there is no bankroll pool for this token");
+    pool_id = pool_itr->pool_id;
+  }
+  
+  setShardBankroll(pool_id, shard, bankroll.amount);
+}
+
+
+
+
+/**
+ * @dev Can be called by the dev account to add a bankroll pool for another token than WAX
+ * The share token has to be created in the token.pink contract with this contract as the issuer before anything is deposited
+ * 
+ * @param token_contract - The account name of the token contract
+ * @param token_symbol - The symbol of the token
+ * @param share_symbol - The symbol of the token.pink token representing shares of the pool
+ */
+ACTION pinkbankroll::addpool(name token_contract, symbol token_symbol, symbol share_symbol) {
+  require_auth("pinknetworkx"_n);
+  
+  check(token_symbol.is_valid() && share_symbol.is_valid(),
+  "invalid symbol");
+  check(token_contract != "token.pink"_n,
+  "token.pink is reserved for the share tokens");
+  //Transfers of eosio.token are always handled by the WAX pool, see receivewaxtransfer
+  check(token_contract != "eosio.token"_n,
+  "eosio.token transfers are only accepted for the WAX pool");
+  check(share_symbol.code() != PINK_SYMBOL.code(),
+  "PINK is reserved for the WAX pool");
+  
+  auto pools_by_token = poolsTable.get_index<"token"_n>();
+  check(pools_by_token.find(uint128_t{token_contract.value} << 64 | token_symbol.raw()) == pools_by_token.end(),
+  "a pool for this token already exists");
+  auto pools_by_share_symbol = poolsTable.get_index<"sharesymbol"_n>();
+  check(pools_by_share_symbol.find(share_symbol.code().raw()) == pools_by_share_symbol.end(),
+  "the share symbol is already used by another pool");
+  
+  //The pool_id 0 is used for the WAX pool
+  uint64_t pool_id = std::max(poolsTable.available_primary_key(), (uint64_t)1);
+  poolsTable.emplace(_self, [&](poolStruct &p) {
+    p.pool_id = pool_id;
+    p.token_contract = token_contract;
+    p.bankroll = asset(0, token_symbol);
+    p.share_supply = asset(0, share_symbol);
+    p.locked_variance = 0;
+    p.paid_rolls = 0;
+  });
+}
+
+
+
+
+/**
+ * @dev Sets the share supply mirror of a pool to the supply of its share token in the token.pink contract
+ * Only needed once for shares that were issued before the supply was mirrored by this contract
+ * 
+ * @param pool_id - The id of the pool
+ */
+ACTION pinkbankroll::syncsupply(uint64_t pool_id) {
+  require_auth(_self);
+  
+  poolStruct& pool = modifyPool(pool_id);
+  pool.share_supply = get_supply("token.pink"_n, pool.share_supply.symbol.code());
+}
+
+
+
+
+/**
+ * Settles queued withdrawals of a pool, if the bankroll is big enough for the active rolls without the withdrawn amount
+ * Can be called by anyone. Withdrawals are also settled automatically after each roll result of the pool
+ * 
+ * @param pool_id - The id of the pool
+ * @param max_count - The max number of withdrawals to settle
+ */
+ACTION pinkbankroll::processwd(uint64_t pool_id, uint32_t max_count) {
+  check(processWithdrawals(pool_id, max_count) > 0,
+  "no queued withdrawal can currently be settled");
+}
+
+
+
+
+/**
+ * Cancels a queued withdrawal and returns the shares to the investor
+ * 
+ * @param withdrawal_id - The id of the queued withdrawal
+ */
+ACTION pinkbankroll::cancelwd(uint64_t withdrawal_id) {
+  auto withdrawal_itr = withdrawalsTable.find(withdrawal_id);
+  check(withdrawal_itr != withdrawalsTable.end(),
+  "no queued withdrawal with this id exists");
+  
+  require_auth(withdrawal_itr->investor);
+  
+  action(
+    permission_level{_self, "active"_n},
+    "token.pink"_n,
+    "transfer"_n,
+    std::make_tuple(_self, withdrawal_itr->investor, withdrawal_itr->shares, std::string("cancelled bankroll withdrawal"))
+  ).send();
+  
+  withdrawalsTable.erase(withdrawal_itr);
+}
+
+
+
+
+/**
+ * Pays out the accrued rake or dev fees of a recipient in one transfer
+ * Can be called by anyone, the fees are always sent to the recipient
+ * 
+ * @param recipient - The account name of the rake or dev fee recipient
+ * @param pool_id - The id of the pool that the fees were accrued in
+ */
+ACTION pinkbankroll::sweepfees(name recipient, uint64_t pool_id) {
+  fees_t feesTable = getFeesTable(pool_id);
+  auto fee_itr = feesTable.find(recipient.value);
+  check(fee_itr != feesTable.end(),
+  "the account has no accrued fees in this pool");
+  
+  asset quantity = fee_itr->balance;
+  feesTable.erase(fee_itr);
+  
+  //The bankroll does not have to be decreased, because that has already happend when the fees were accrued
+  action(
+    permission_level{_self, "active"_n},
+    getPool(pool_id).token_contract,
+    "transfer"_n,
+    std::make_tuple(_self, recipient, quantity, std::string("pinkbankroll fees"))
+  ).send();
+}
+
+
+
+
+/**
+ * @dev Rewrites the rolls that were stored before the fields after paid were added to them, and moves their bets
+ * from the rollbets table of each roll to the packedbets table
+ * Needs to be called in the same transaction as the contract update until all rolls have been rewritten,
+ * so that no roll is read with the old layout
+ * 
+ * The rolls are erased and emplaced again, because their layout changes. Rolls that were already paid for lock their variance
+ * in the WAX pool, the same as rolls that are started with the current contract, because it is released again with their result
+ * 
+ * @param max_count - The max number of bets and rolls to move in this action. A roll is only rewritten after all of its bets have been moved
+ */
+ACTION pinkbankroll::migraterolls(uint32_t max_count) {
+  require_auth(_self);
+  
+  legacy_rolls_t legacyRollsTable(_self, _self.value);
+  uint32_t migrated_count = 0;
+  auto legacy_itr = legacyRollsTable.begin();
+  while (migrated_count < max_count && legacy_itr != legacyRollsTable.end()) {
+    if (legacy_itr->bet_count.has_value()) {
+      legacy_itr++;
+      continue;
+    }
+    
+    legacy_bets_t legacyBetsTable(_self, legacy_itr->roll_id);
+    auto bet_itr = legacyBetsTable.begin();
+    while (migrated_count < max_count && bet_itr != legacyBetsTable.end()) {
+      check(bet_itr->bet_id <= 0xFFFF,
+      "a roll can't have more than 65536 bets");
+      betsTable.emplace(_self, [&](betStruct &b) {
+        b.bet_key = getBetKey(legacy_itr->roll_id, bet_itr->bet_id);
+        b.bettor = bet_itr->bettor;
+        b.amount = bet_itr->quantity.amount;
+        b.packed_bet = packBet(bet_itr->lower_bound, bet_itr->upper_bound, bet_itr->multiplier, 0);
+        b.random_seed = bet_itr->random_seed;
+      });
+      //erase returns iterator poiting to next entry
+      bet_itr = legacyBetsTable.erase(bet_itr);
+      migrated_count++;
+    }
+    if (bet_itr != legacyBetsTable.end()) {
+      //The remaining bets of the roll are moved in the next call
+      break;
+    }
+    
+    rollStruct roll;
+    roll.roll_id = legacy_itr->roll_id;
+    roll.creator = legacy_itr->creator;
+    roll.creator_id = legacy_itr->creator_id;
+    roll.max_result = legacy_itr->max_result;
+    roll.rake_recipient = legacy_itr->rake_recipient;
+    roll.paid = legacy_itr->paid;
+    roll.bet_count = 0;
+    roll.external_bets = false;
+    roll.pool_id = 0;
+    roll.draw_count = 1;
+    roll.locked_variance = 0;
+    roll.paid_amount = 0;
+    
+    //Same sums as in handleStartRoll
+    std::vector<uint64_t> total_bets_collected(1, 0);
+    std::vector<uint32_t> bet_counts(1, 0);
+    forEachBet(roll, [&](const betStruct& bet) {
+      if (roll.paid) {
+        roll.paid_amount += bet.amount;
+      }
+      double ev = (double)bet.get_multiplier() / 1000.0 * (double)(bet.get_upper_bound() - bet.get_lower_bound() + 1) / (double)roll.max_result;
+      total_bets_collected[0] += (int64_t)((double)bet.amount * (ev + 0.007));
+      bet_counts[0] += 1;
+      roll.bet_count = bet.get_bet_id() + 1;
+    });
+    
+    if (roll.paid) {
+      roll.locked_variance = getRollVariance(roll, total_bets_collected, bet_counts);
+      poolStruct& pool = modifyPool(0);
+      pool.locked_variance += roll.locked_variance;
+      pool.paid_rolls += 1;
+    }
+    
+    //erase returns iterator poiting to next entry
+    legacy_itr = legacyRollsTable.erase(legacy_itr);
+    rollsTable.emplace(_self, [&](auto& r) {
+      r = roll;
+    });
+    migrated_count++;
+  }
+  
+  check(migrated_count > 0,
+  "there are no rolls left to migrate");
+}
+
+
+
+
+/**
+ * This is called by the RNG oracle, providing the randomness for calculating the result
+ * Note: In the case there are a lot (>100) bets that are all being paid out, this action could theoretically take more than 30ms to execute
+ *       If that is the case, the transaction will fail. Depending on the functionality of the oracle, the transaction might be resent.
+ *       It is the responsibility of the 3rd party dev using the pinkbankroll contract to ensure that this doesn't happen by enforcing an appropiate max bet limit
+ * 
+ * @param assoc_id - The assoc_id that was provided to the oracle when requesting the random value. Equal to the roll_id
+ * @param random_value - The sha256 hash of the random seed that was provided when starting the roll. Is used as randomness
+ */
+ACTION pinkbankroll::receiverand(uint64_t assoc_id, checksum256 random_value) {
+  require_auth("orng.wax"_n);
+  
+  auto rolls_itr = rollsTable.find(assoc_id);
+  check(rolls_itr != rollsTable.end(),
+  "no bet with this id exists");
+  check(rolls_itr->paid,
+  "this roll has not been paid for yet");
+  
+  name roll_creator = rolls_itr->creator;
+  uint64_t roll_creator_id = rolls_itr->creator_id;
+  name roll_rake_recipient = rolls_itr->rake_recipient;
+  uint64_t pool_id = rolls_itr->pool_id;
+  symbol pool_symbol = getPool(pool_id).bankroll.symbol;
+  payouts_t payoutsTable = getPayoutsTable(pool_id);
+  
+  if (rolls_itr->external_bets) {
+    //The external bets are verified before any of them is settled. Bets that were changed after the roll was started
+    //don't have the risk that was accepted. Failing here would leave the roll and its locked variance in place forever,
+    //so the roll is rejected instead and the amount paid for it is credited to the creator's payouts
+    std::vector<char> bets_data;
+    forEachBet(*rolls_itr, [&](const betStruct& bet) {
+      std::vector<char> packed_bet = pack(bet);
+      bets_data.insert(bets_data.end(), packed_bet.begin(), packed_bet.end());
+    });
+    
+    if (sha256(bets_data.data(), bets_data.size()) != rolls_itr->bets_hash) {
+      asset refund = asset(rolls_itr->paid_amount, pool_symbol);
+      creditPayout(payoutsTable, roll_creator, refund);
+      unlockRoll(*rolls_itr);
+      rollsTable.erase(rolls_itr);
+      
+      action(
+        permission_level{_self, "active"_n},
+        _self,
+        "logreject"_n,
+        std::make_tuple(assoc_id, roll_creator, roll_creator_id, refund)
+      ).send();
+      
+      processWithdrawals(pool_id, MAX_WITHDRAWALS_PER_RESULT);
+      
+      //The creator won't receive a result for the roll, so it has to release the bets of the roll itself
+      action(
+        permission_level{_self, "active"_n},
+        _self,
+        "notifyreject"_n,
+        std::make_tuple(roll_creator, roll_creator_id, refund)
+      ).send();
+      return;
+    }
+  }
+  
+  
+  uint32_t draw_count = rolls_itr->draw_count;
+  std::vector<uint32_t> results;
+  for (uint32_t draw_index = 0; draw_index < draw_count; draw_index++) {
+    results.push_back(getDrawResult(random_value, draw_index, rolls_itr->max_result));
+  }
+  //The result of the first draw is the result of single draw rolls
+  uint32_t result = results[0];
+  print("Result: ", result, " / ", rolls_itr->max_result);
+  
+  asset total_rake = asset(0, pool_symbol);
+  asset total_dev_fee = asset(0, pool_symbol);
+  asset bankroll_change = asset(0, pool_symbol); //Disregarding rake/ fee
+  
+  auto settle_bet = [&](name bettor, int64_t amount, uint32_t multiplier, double odds, bool won, uint64_t bet_id) {
+    //Calculating the rake/ fee to payouts
+    double ev = (double)multiplier / 1000.0 * odds;
+    double edge = 1.0 - ev;
+    total_rake.amount += (int64_t)((double)amount * (edge - 0.01));
+    total_dev_fee.amount += (int64_t)((double)amount * 0.003);
+    
+    //Calculating the bet outcome
+    bankroll_change.amount += amount;
+    
+    if (won) {
+      //This bet won
+      asset quantity_won = asset(amount, pool_symbol) * multiplier / 1000;
+      bankroll_change -= quantity_won;
+      
+      creditPayout(payoutsTable, bettor, quantity_won);
+      
+      //Deferred transactions have to be used in order to guarantee that no single bet can make the whole payout throw
+      //They are however not 100% guaranteed to go through. Therefore, users can also manually withdraw their bets with the payoutbet action
+      
+      eosio::transaction t;
+      if (pool_id == 0) {
+        t.actions.emplace_back(
+          permission_level(_self, "active"_n),
+          _self,
+          "payoutbet"_n,
+          std::make_tuple(bettor, quantity_won)
+        );
+      } else {
+        t.actions.emplace_back(
+          permission_level(_self, "active"_n),
+          _self,
+          "poolpayout"_n,
+          std::make_tuple(bettor, pool_id, quantity_won)
+        );
+      }
+      
+      //The roll id and bet id are unique for every bet that hasn't been settled yet
+      uint64_t deferred_id = getBetKey(assoc_id, bet_id);
+      t.send(deferred_id, _self);
+      
+    }
+  };
+  
+  //The draw indices of the bets were checked when the roll was started
+  forEachBet(*rolls_itr, [&](const betStruct& bet) {
+    uint32_t bet_result = results[bet.get_draw_index()];
+    
+    double odds = (double)(bet.get_upper_bound() - bet.get_lower_bound() + 1) / (double)rolls_itr->max_result;
+    bool won = bet.get_lower_bound() <= bet_result && bet_result <= bet.get_upper_bound();
+    settle_bet(bet.bettor, bet.amount, bet.get_multiplier(), odds, won, bet.get_bet_id());
+  });
+  
+  //The mask bets are checked with a single bit of their mask
+  forEachMaskBet(*rolls_itr, [&](const maskBetStruct& bet) {
+    double odds = (double)bet.get_result_count() / (double)rolls_itr->max_result;
+    settle_bet(bet.bettor, bet.amount, bet.multiplier, odds, bet.wins(results[bet.draw_index]), bet.get_bet_id());
+  });
+  
+  //External bets are erased by the creator when it receives the result
+  if (!rolls_itr->external_bets) {
+    eraseRollBets(assoc_id);
+  }
+  
+  //The rake and dev fee are taken from the bankroll right away, but only paid out with sweepfees
+  asset net_bankroll_change = bankroll_change - total_rake - total_dev_fee;
+  poolStruct& pool = modifyPool(pool_id);
+  pool.bankroll += net_bankroll_change;
+  unlockRoll(*rolls_itr);
+  accrueFee(pool_id, roll_rake_recipient, total_rake);
+  accrueFee(pool_id, "pinknetworkx"_n, total_dev_fee);
+  
+  //Removing roll table entry
+  rollsTable.erase(rolls_itr);
+  
+  action(
+    permission_level{_self, "active"_n},
+    _self,
+    "logbrchange"_n,
+    std::make_tuple(net_bankroll_change, std::string("roll result after rake and devfee"), pool.bankroll)
+  ).send();
+  
+  action(
+    permission_level{_self, "active"_n},
+    _self,
+    "loggetrand"_n,
+    std::make_tuple(assoc_id, result, net_bankroll_change, pool.bankroll, random_value)
+  ).send();
+  
+  //The roll doesn't lock any bankroll anymore, so queued withdrawals might be possible now
+  processWithdrawals(pool_id, MAX_WITHDRAWALS_PER_RESULT);
+  
+  action(
+    permission_level{_self, "active"_n},
+    _self,
+    "notifyresult"_n,
+    std::make_tuple(roll_creator, roll_creator_id, result)
+  ).send();
+  
+  if (draw_count > 1) {
+    action(
+      permission_level{_self, "active"_n},
+      _self,
+      "notifydraws"_n,
+      std::make_tuple(roll_creator, roll_creator_id, results)
+    ).send();
+  }
+}
+
+
+
+
+/**
+ * This is called whenever there is a eosio.token transfer involving pinkbankroll as either sender or recipient
+ * It is used to handle deposits to the bankroll, as well as to start rolls_itr
  * 
  * @param from - The account name that sent the transfer
  * @param to - The account name that receives the transfer
@@ -336,15 +1030,74 @@ void pinkbankroll::receivewaxtransfer(name from, name to, asset quantity, std::s
   check(quantity.symbol == CORE_SYMBOL,
   "quantity must be in WAX");
   
+  handleTransfer(0, from, quantity, memo);
+}
+
+
+
+
+/**
+ * This is called whenever there is a transfer of any other token contract involving pinkbankroll as either sender or recipient
+ * The same memos as for WAX transfers are used for the pools of other tokens (see addpool)
+ * 
+ * @param from - The account name that sent the transfer
+ * @param to - The account name that receives the transfer
+ * @param quantity - The quantity of tokens sent
+ * @param memo - A string of up to 256 characers, used to identify what this transaction is meant for
+ */
+void pinkbankroll::receivepooltransfer(name from, name to, asset quantity, std::string memo) {
+  //Transfers of these contracts are handled by receivewaxtransfer and receivepinktransfer
+  if (to != _self || get_first_receiver() == "eosio.token"_n || get_first_receiver() == "token.pink"_n) {
+    return;
+  }
+  
+  auto pools_by_token = poolsTable.get_index<"token"_n>();
+  auto pool_itr = pools_by_token.find(uint128_t{get_first_receiver().value} << 64 | quantity.symbol.raw());
+  check(pool_itr != pools_by_token.end(),
+  "there is no bankroll pool for this token");
+  
+  handleTransfer(pool_itr->pool_id, from, quantity, memo);
+}
+
+
+
+
+/**
+ * Private function to handle a transfer to the bankroll of a pool, as parsed from receivewaxtransfer or receivepooltransfer
+ * 
+ * @param pool_id - The id of the pool of the transfered token
+ * @param from - The account name that sent the transfer
+ * @param quantity - The quantity of tokens sent
+ * @param memo - A string of up to 256 characers, used to identify what this transaction is meant for
+ */
+void pinkbankroll::handleTransfer(uint64_t pool_id, name from, asset quantity, std::string memo) {
   if (memo.compare("deposit") == 0) {
-    handleDeposit(from, quantity);
+    handleDeposit(pool_id, from, quantity);
     
   } else if (memo.find("startroll ") == 0) {
     int64_t firstWhitespace = memo.find(" ");
     std::string idstring = memo.substr(firstWhitespace);
     uint64_t parsed_creator_id = std::strtoull(idstring.c_str(), 0, 10);
     
-    handleStartRoll(from, parsed_creator_id, quantity);
+    handleStartRoll(pool_id, from, parsed_creator_id, quantity);
+    
+  } else if (memo.compare("#rebalance") == 0) {
+    check(shardsTable.find(from.value) != shardsTable.end(),
+    "only registered shards can rebalance the bankroll");
+    
+    poolStruct& pool = modifyPool(pool_id);
+    pool.bankroll += quantity;
+    
+    action(
+      permission_level{_self, "active"_n},
+      _self,
+      "logbrchange"_n,
+      std::make_tuple(quantity, std::string("bankroll rebalance"), pool.bankroll)
+    ).send();
+    reportBankroll(pool_id);
+    
+    //The added bankroll might make queued withdrawals possible
+    processWithdrawals(pool_id, MAX_WITHDRAWALS_PER_RESULT);
     
   } else {
     check(false, "invalid memo");
@@ -356,13 +1109,8 @@ void pinkbankroll::receivewaxtransfer(name from, name to, asset quantity, std::s
 
 /**
  * This is called whenever there is a token.pink transfer involving pinkbankroll as either sender or recipient
- * When PINK is sent to the pinkbankroll account, this is interpreted as a withdrawal
- * The PINK tokens get burned and the sender will get the corresponding part of the current bankroll in WAX
- * 
- * Note: It is checked if there are any active rolls (already paid and waiting for oracle callback) that would not have been accepted if this
- *       withdrawal had gone through before the roll. This is to prevent attackers from first depositing to increase the max bet, then betting this max bet,
- *       and then withdrawing before the bet goes though.
- *       In practice, this should only happen very rarely.
+ * When PINK (or the shares of another pool) is sent to the pinkbankroll account, this is interpreted as a withdrawal
+ * The withdrawal is queued and settled as soon as possible, see processWithdrawals. Usually, this is immediately
  * 
  * @param from - The account name that sent the transfer
  * @param to - The account name that receives the transfer
@@ -374,49 +1122,32 @@ void pinkbankroll::receivepinktransfer(name from, name to, asset quantity, std::
   if (to != _self) {
     return;
   }
-  check(quantity.symbol == PINK_SYMBOL,
-  "quantity must be in PINK");
-  
-  statsStruct stats = statsTable.get();
-  uint64_t amount_to_withdraw = (uint64_t)((double)stats.bankroll.amount * (double)quantity.amount / (double)get_supply("token.pink"_n, PINK_SYMBOL.code()).amount);
-  asset wax_to_withdraw = asset(amount_to_withdraw, CORE_SYMBOL);
-  
-  auto rolls_by_paid = rollsTable.get_index<"haspaid"_n>();
-  
-  
-  // This goes through all rolls that are already paid and waiting for the oracle callback
-  // If any of those rolls need the WAX that would be withdrawn to stay within the bankroll management, this withdrawal will fail
-  // This means that the PINK transfer will fail as well, so no funds would be lost
-  for (auto roll_itr = rolls_by_paid.find(1); roll_itr != rolls_by_paid.end(); roll_itr++) {
-    
-    asset total_bets_collected = asset(0, CORE_SYMBOL);  // = total_quantity_bet - (rake + fees)
-    
-    uint32_t max_range = roll_itr->max_result;
-    ChainedRange firstRange = ChainedRange(1, max_range, 0);
-    rollBets_t betsTable(_self, roll_itr->roll_id);
-    
-    for (auto bet_itr = betsTable.begin(); bet_itr != betsTable.end(); bet_itr++) {
-      double ev = (double)bet_itr->multiplier / 1000.0 * (double)(bet_itr->upper_bound - bet_itr->lower_bound + 1) / (double)max_range;
-      total_bets_collected.amount += (int64_t)((double)bet_itr->quantity.amount * (ev + 0.007));
-      
-      uint64_t payout = bet_itr->quantity.amount * bet_itr->multiplier / 1000;
-      firstRange.insertBet(bet_itr->lower_bound, bet_itr->upper_bound, payout);
-    }
-    
-    asset required_bankroll = getRequiredBankroll(firstRange, total_bets_collected.amount, max_range);
-    check(required_bankroll < stats.bankroll - wax_to_withdraw,
-    "Can't withdraw because there currently is an active roll that is too big to run without this amount. Try again a second from now.");
+  check(isShareIssuer(),
+  "withdrawals are only accepted by the contract that issues the shares");
+  
+  //PINK are the shares of the WAX pool. The shares of the other pools are found by their symbol
+  uint64_t pool_id = 0;
+  if (quantity.symbol != PINK_SYMBOL) {
+    auto pools_by_share_symbol = poolsTable.get_index<"sharesymbol"_n>();
+    auto pool_itr = pools_by_share_symbol.find(quantity.symbol.code().raw());
+    check(pool_itr != pools_by_share_symbol.end() && pool_itr->share_supply.symbol == quantity.symbol,
+    "quantity must be in PINK or in the shares of a pool");
+    pool_id = pool_itr->pool_id;
   }
   
+  check(quantity.amount <= getPool(pool_id).share_supply.amount,
+  "quantity exceeds the share supply of the pool");
   
-  action(
-    permission_level{_self, "active"_n},
-    "token.pink"_n,
-    "retire"_n,
-    std::make_tuple(quantity, std::string("bankroll withdrawal token burn"))
-  ).send();
+  //available_primary_key can't be used, because settled withdrawals are deleted from the table
+  uint64_t withdrawal_id = modifyStats().current_withdrawal_id.value()++;
+  withdrawalsTable.emplace(_self, [&](withdrawalStruct &w) {
+    w.withdrawal_id = withdrawal_id;
+    w.pool_id = pool_id;
+    w.investor = from;
+    w.shares = quantity;
+  });
   
-  transferFromBankroll(from, wax_to_withdraw, std::string("bankroll withdraw"));
+  processWithdrawals(pool_id, MAX_WITHDRAWALS_PER_RESULT);
 }
 
 
@@ -424,29 +1155,29 @@ void pinkbankroll::receivepinktransfer(name from, name to, asset quantity, std::
 
 /**
  * Private helper function to handle withdraws from the bankroll
+ * @param pool_id - The id of the pool to withdraw from
  * @param recipient - The name of the account to receive the payment
- * @param quantity - The amount of WAX to send
+ * @param quantity - The amount of the pool's token to send
  * @param memo - The memo to send with the transfer
  */
-void pinkbankroll::transferFromBankroll(name recipient, asset quantity, std::string memo) {
+void pinkbankroll::transferFromBankroll(uint64_t pool_id, name recipient, asset quantity, std::string memo) {
   //The eosio.token contract will throw on zero amount transfers
   if (quantity.amount == 0) {
     return;
   }
-  statsStruct stats = statsTable.get();
-  stats.bankroll -= quantity;
-  statsTable.set(stats, _self);
+  poolStruct& pool = modifyPool(pool_id);
+  pool.bankroll -= quantity;
   
   action(
     permission_level{_self, "active"_n},
     _self,
     "logbrchange"_n,
-    std::make_tuple(-quantity, memo, stats.bankroll)
+    std::make_tuple(-quantity, memo, pool.bankroll)
   ).send();
   
   action(
     permission_level{_self, "active"_n},
-    "eosio.token"_n,
+    pool.token_contract,
     "transfer"_n,
     std::make_tuple(_self, recipient, quantity, memo)
   ).send();
@@ -456,8 +1187,38 @@ void pinkbankroll::transferFromBankroll(name recipient, asset quantity, std::str
 
 
 /**
- * Private function to handle deposits (as parsed from the receivewaxtransfer action)
+ * Private function to add rake or dev fees to the accrued fees of a recipient
+ * The fees have to already be removed from the bankroll of the pool
  * 
+ * @param pool_id - The id of the pool the fees were taken from
+ * @param recipient - The account name of the rake or dev fee recipient
+ * @param quantity - The amount of the fees
+ */
+void pinkbankroll::accrueFee(uint64_t pool_id, name recipient, asset quantity) {
+  if (quantity.amount == 0) {
+    return;
+  }
+  fees_t feesTable = getFeesTable(pool_id);
+  auto fee_itr = feesTable.find(recipient.value);
+  if (fee_itr != feesTable.end()) {
+    feesTable.modify(fee_itr, _self, [&](auto& f) {
+      f.balance += quantity;
+    });
+  } else {
+    feesTable.emplace(_self, [&](auto& f) {
+      f.recipient = recipient;
+      f.balance = quantity;
+    });
+  }
+}
+
+
+
+
+/**
+ * Private function to handle deposits (as parsed from the receivewaxtransfer and receivepooltransfer actions)
+ * 
+ * @param pool_id - The id of the pool to deposit to
  * @param investor - The account name that sent the deposit
  * @param quantity - The amount of WAX to be invested
  * 
@@ -465,60 +1226,126 @@ void pinkbankroll::transferFromBankroll(name recipient, asset quantity, std::str
  * If a user owns 10% of the supply of PINK tokens, that means that he is entitled to 10% of the bankroll
  * When a new deposit is made, instead of inefficiently changing the balance of each token holder, new tokens are issued
  */
-void pinkbankroll::handleDeposit(name investor, asset quantity) {
+void pinkbankroll::handleDeposit(uint64_t pool_id, name investor, asset quantity) {
   check(!isPaused(),
   "the contract is paused, only withdrawals and payouts are currently allowed");
+  check(isShareIssuer(),
+  "deposits are only accepted by the contract that issues the shares");
   
-  statsStruct stats = statsTable.get();
+  poolStruct& pool = modifyPool(pool_id);
+  //The shares are priced by the bankroll of all shards
+  int64_t total_bankroll = getTotalBankroll(pool);
+  check(total_bankroll == 0 || pool.share_supply.amount > 0,
+  "the share supply of this pool has not been synced yet, see syncsupply");
   
   uint64_t added_pink_amount;
-  if (stats.bankroll.amount == 0) {
-    added_pink_amount = quantity.amount / 1000; //WAX has 8 digits, PINK has 4 digits. Therefore deviding by 1000 means that the pink quantity will be 10x the wax quantity
+  if (total_bankroll == 0) {
+    //The first deposit gets 10 shares per token. For the WAX pool (8 digits) and PINK (4 digits), this means deviding by 1000
+    int128_t amount = (int128_t)quantity.amount * 10;
+    for (uint8_t i = 0; i < pool.share_supply.symbol.precision(); i++) {
+      amount *= 10;
+    }
+    for (uint8_t i = 0; i < quantity.symbol.precision(); i++) {
+      amount /= 10;
+    }
+    added_pink_amount = (uint64_t)amount;
   } else {
-    added_pink_amount = (uint64_t) ((double)quantity.amount / (double)stats.bankroll.amount * (double)get_supply("token.pink"_n, PINK_SYMBOL.code()).amount);
+    added_pink_amount = (uint64_t)((int128_t)quantity.amount * pool.share_supply.amount / total_bankroll);
   }
   check(added_pink_amount > 0,
-  "The deposit is so small that it would equate to 0 PINK");
-  asset added_pink_quantity = asset(added_pink_amount, PINK_SYMBOL);
-  
-  stats.bankroll += quantity;
-  statsTable.set(stats, _self);
-  
-  action(
-    permission_level{_self, "active"_n},
-    "token.pink"_n,
-    "issue"_n,
-    std::make_tuple(_self, added_pink_quantity, std::string("token issue for deposit"))
-  ).send();
+  "The deposit is so small that it would equate to 0 shares");
+  asset added_pink_quantity = asset(added_pink_amount, pool.share_supply.symbol);
   
+  pool.bankroll += quantity;
+  pool.share_supply += added_pink_quantity;
+  
+  //The shares are issued directly to the investor
   action(
     permission_level{_self, "active"_n},
     "token.pink"_n,
-    "transfer"_n,
-    std::make_tuple(_self, investor, added_pink_quantity, std::string("token issue for deposit"))
+    "issue"_n,
+    std::make_tuple(investor, added_pink_quantity, std::string("token issue for deposit"))
   ).send();
   
   action(
     permission_level{_self, "active"_n},
     _self,
     "logbrchange"_n,
-    std::make_tuple(quantity, std::string("bankroll deposit"), stats.bankroll)
+    std::make_tuple(quantity, std::string("bankroll deposit"), pool.bankroll)
   ).send();
 }
 
 
 
 
+/**
+ * Private function to settle the queued withdrawals of a pool in the order they were requested
+ * All withdrawals settled at once get the same share price. The withdrawn shares are retired with a single action
+ * 
+ * Note: A withdrawal is only settled if all active rolls (already paid and waiting for oracle callback) of the pool together would still have been accepted
+ *       with the bankroll after the withdrawal, see locked_variance. This is to prevent attackers from first depositing to increase the max bet, then betting this max bet,
+ *       and then withdrawing before the bet goes though. Later withdrawals wait until the first one has been settled
+ * 
+ * @param pool_id - The id of the pool
+ * @param max_count - The max number of withdrawals to settle
+ * @return - The number of settled withdrawals
+ */
+uint32_t pinkbankroll::processWithdrawals(uint64_t pool_id, uint32_t max_count) {
+  auto withdrawals_by_pool = withdrawalsTable.get_index<"poolandid"_n>();
+  auto withdrawal_itr = withdrawals_by_pool.lower_bound(uint128_t{pool_id} << 64);
+  if (withdrawal_itr == withdrawals_by_pool.end() || withdrawal_itr->pool_id != pool_id) {
+    return 0;
+  }
+  
+  poolStruct& pool = modifyPool(pool_id);
+  int64_t locked_bankroll = (int64_t)getRequiredBankrollFromVariance(pool.locked_variance);
+  //The shares are priced by the bankroll of all shards, but can only be paid out from the bankroll of this contract
+  int64_t price_bankroll = getTotalBankroll(pool);
+  int64_t price_share_supply = pool.share_supply.amount;
+  asset retired_shares = asset(0, pool.share_supply.symbol);
+  
+  uint32_t count = 0;
+  while (count < max_count && withdrawal_itr != withdrawals_by_pool.end() && withdrawal_itr->pool_id == pool_id) {
+    int64_t amount_to_withdraw = (int64_t)((int128_t)price_bankroll * withdrawal_itr->shares.amount / price_share_supply);
+    if (locked_bankroll >= pool.bankroll.amount - amount_to_withdraw) {
+      break;
+    }
+    
+    retired_shares += withdrawal_itr->shares;
+    transferFromBankroll(pool_id, withdrawal_itr->investor, asset(amount_to_withdraw, pool.bankroll.symbol), std::string("bankroll withdraw"));
+    
+    withdrawal_itr = withdrawals_by_pool.erase(withdrawal_itr);
+    count++;
+  }
+  
+  if (retired_shares.amount > 0) {
+    pool.share_supply -= retired_shares;
+    
+    action(
+      permission_level{_self, "active"_n},
+      "token.pink"_n,
+      "retire"_n,
+      std::make_tuple(retired_shares, std::string("bankroll withdrawal token burn"))
+    ).send();
+  }
+  
+  return count;
+}
+
+
+
+
 /**
  * Private function to handle starting a roll (as parsed from the receivewaxtransfer action)
- * Note: This has a worst case runtime of O(bets^2) and could theoretically take more than 30ms if the roll has a lot of different bets
+ * Note: This reads the bets of the roll several times and could theoretically take more than 30ms if the roll has a lot of different bets
  *       If this happens, the transaction will fail. This means that the WAX transfer will also fail, so no funds will be lost
  * 
+ * @param pool_id - The id of the pool of the transfered token
  * @param creator - The acccount name of the creator of the roll, and also the account that sends the transfer
  * @param creator_id - The creator id of the roll to start, as parsed from the transfer memo
  * @param quantity - The amount of WAX that was sent with this transaction. Needs to be equal to the total quantity bet in this roll
  */
-void pinkbankroll::handleStartRoll(name creator, uint64_t creator_id, asset quantity) {
+void pinkbankroll::handleStartRoll(uint64_t pool_id, name creator, uint64_t creator_id, asset quantity) {
   check(!isPaused(),
   "the contract is paused, only withdrawals and payouts are currently allowed");
   
@@ -530,35 +1357,62 @@ void pinkbankroll::handleStartRoll(name creator, uint64_t creator_id, asset quan
   "no bet with the specified creator_id has been announced");
   check(!itr_creator_and_id->paid,
   "the roll has already been paid for");
+  check(itr_creator_and_id->pool_id == pool_id,
+  "the roll has to be paid in the token of its pool");
   
-  asset total_quantity_bet = asset(0, CORE_SYMBOL);
-  asset total_bets_collected = asset(0, CORE_SYMBOL);  // = total_quantity_bet - (rake + fees)
+  asset total_quantity_bet = asset(0, quantity.symbol);
   
   uint32_t max_range = itr_creator_and_id->max_result;
-  ChainedRange firstRange = ChainedRange(1, max_range, 0);
-  rollBets_t betsTable(_self, itr_creator_and_id->roll_id);
+  uint32_t draw_count = itr_creator_and_id->draw_count;
+  //The bets of different draws are settled by different results, so every draw has its own sums
+  std::vector<uint64_t> total_bets_collected(draw_count, 0);  // = total_quantity_bet - (rake + fees)
+  std::vector<uint32_t> bet_counts(draw_count, 0);
   
   uint64_t signing_value = 0;
   uint64_t signing_xor = 0;
   uint64_t bet_number = 0;
+  //The serialized bets, only needed to commit to the external bets
+  std::vector<char> bets_data;
   
-  for (auto it = betsTable.begin(); it != betsTable.end(); it++) {
-    total_quantity_bet += it->quantity;
-    double ev = (double)it->multiplier / 1000.0 * (double)(it->upper_bound - it->lower_bound + 1) / (double)max_range;
-    total_bets_collected.amount += (int64_t)((double)it->quantity.amount * (ev + 0.007));
-    
-    uint64_t payout = it->quantity.amount * it->multiplier / 1000;
-    firstRange.insertBet(it->lower_bound, it->upper_bound, payout);
-    
+  auto add_random_seed = [&](uint64_t random_seed) {
     //For up to the first 32 bits, the n'th bit of the signing_value will be the first bit of the n'th bet's random seed
     //This prevents an attacker being able to change the signing_value to anything he wants by sending the last bet, by having some bits that are not possible to change
     if (bet_number < 32) {
-      signing_value += (it->random_seed & 0x8000000000000000) >> bet_number;
+      signing_value += (random_seed & 0x8000000000000000) >> bet_number;
       bet_number++;
     };
     
-    signing_xor = signing_xor ^ it->random_seed;
-  }
+    signing_xor = signing_xor ^ random_seed;
+  };
+  
+  forEachBet(*itr_creator_and_id, [&](const betStruct& bet) {
+    //External bets are not checked when they are added
+    check(bet.get_draw_index() < draw_count,
+    "the bet targets a draw that the roll doesn't have");
+    
+    total_quantity_bet.amount += bet.amount;
+    double ev = (double)bet.get_multiplier() / 1000.0 * (double)(bet.get_upper_bound() - bet.get_lower_bound() + 1) / (double)max_range;
+    total_bets_collected[bet.get_draw_index()] += (int64_t)((double)bet.amount * (ev + 0.007));
+    bet_counts[bet.get_draw_index()] += 1;
+    
+    add_random_seed(bet.random_seed);
+    
+    if (itr_creator_and_id->external_bets) {
+      std::vector<char> packed_bet = pack(bet);
+      bets_data.insert(bets_data.end(), packed_bet.begin(), packed_bet.end());
+    }
+  });
+  
+  //Every range of a mask bet adds to the number of ranges like a separate bet, but its payout is only counted once
+  //because the ranges of the same bet never overlap
+  forEachMaskBet(*itr_creator_and_id, [&](const maskBetStruct& bet) {
+    total_quantity_bet.amount += bet.amount;
+    double ev = (double)bet.multiplier / 1000.0 * (double)bet.get_result_count() / (double)max_range;
+    total_bets_collected[bet.draw_index] += (int64_t)((double)bet.amount * (ev + 0.007));
+    bet_counts[bet.draw_index] += bet.get_interval_count();
+    
+    add_random_seed(bet.random_seed);
+  });
   
   //The remaining bits will be the xor of all random seeds
   signing_value += (signing_xor >> bet_number);
@@ -569,11 +1423,19 @@ void pinkbankroll::handleStartRoll(name creator, uint64_t creator_id, asset quan
   check(quantity == total_quantity_bet,
   "quantity needs to be equal to the total quantity bet of the roll");
   
-  asset required_bankroll = getRequiredBankroll(firstRange, total_bets_collected.amount, max_range);
-  statsStruct stats = statsTable.get();
-  check(stats.bankroll >= required_bankroll,
+  //The roll is checked together with all other rolls of the pool that are waiting for their result
+  //Their variances are added up the same way as the variances of independent draws, see locked_variance
+  poolStruct& pool = modifyPool(pool_id);
+  
+  //The exact variance of the roll is locked, so that the pool doesn't hold back more of its bankroll than the active rolls need
+  //Since it is needed anyway, the roll is checked with it directly instead of with an upper limit (see getVarianceBound)
+  double roll_variance = getRollVariance(*itr_creator_and_id, total_bets_collected, bet_counts);
+  check(pool.bankroll.amount >= (int64_t)getRequiredBankrollFromVariance(pool.locked_variance + roll_variance),
   "the current bankroll is too small to accept this roll");
   
+  pool.locked_variance += roll_variance;
+  pool.paid_rolls += 1;
+  
   
   //Check if the signing_value was already used.
   //If that is the case, increment the signing_value until a non-used value is found
@@ -585,6 +1447,11 @@ void pinkbankroll::handleStartRoll(name creator, uint64_t creator_id, asset quan
   
   rolls_by_creator_and_id.modify(itr_creator_and_id, _self, [&](auto &r) {
     r.paid = true;
+    r.locked_variance = roll_variance;
+    r.paid_amount = quantity.amount;
+    if (r.external_bets) {
+      r.bets_hash = sha256(bets_data.data(), bets_data.size());
+    }
   });
   
   action(
@@ -606,8 +1473,402 @@ void pinkbankroll::handleStartRoll(name creator, uint64_t creator_id, asset quan
 
 
 bool pinkbankroll::isPaused() {
-  statsStruct stats = statsTable.get();
-  return stats.paused;
+  return getStats().paused;
+}
+
+
+
+
+/**
+ * Private function to get the bankroll of a pool summed over this contract and the bankroll that its shards last reported, see reportshard
+ * 
+ * @param pool - The pool of this contract
+ */
+int64_t pinkbankroll::getTotalBankroll(const poolStruct& pool) {
+  auto total_itr = shardTotalsTable.find(pool.pool_id);
+  if (total_itr == shardTotalsTable.end()) {
+    return pool.bankroll.amount;
+  }
+  return pool.bankroll.amount + total_itr->bankroll;
+}
+
+
+
+
+/**
+ * Private function to check if this contract issues the shares, instead of being a shard of the instance that does, see setissuer
+ */
+bool pinkbankroll::isShareIssuer() {
+  return shardConfigTable.get_or_default().issuer == name();
+}
+
+
+
+
+/**
+ * Private function to report the current bankroll of a pool to the issuing instance, if this contract is one of its shards
+ * 
+ * @param pool_id - The id of the pool
+ */
+void pinkbankroll::reportBankroll(uint64_t pool_id) {
+  name issuer = shardConfigTable.get_or_default().issuer;
+  if (issuer == name()) {
+    return;
+  }
+  
+  const poolStruct& pool = getPool(pool_id);
+  action(
+    permission_level{_self, "active"_n},
+    issuer,
+    "reportshard"_n,
+    std::make_tuple(_self, pool.token_contract, pool.bankroll)
+  ).send();
+}
+
+
+
+
+/**
+ * Private function to set the mirrored bankroll of a shard and update the sum of the pool with the difference
+ * 
+ * @param pool_id - The id of the pool of this contract
+ * @param shard - The account name of the shard
+ * @param amount - The bankroll of the pool on the shard. The mirror of the shard is erased if it is 0
+ */
+void pinkbankroll::setShardBankroll(uint64_t pool_id, name shard, int64_t amount) {
+  shard_bankrolls_t shardBankrollsTable(_self, pool_id);
+  auto shard_itr = shardBankrollsTable.find(shard.value);
+  int64_t previous_amount = shard_itr == shardBankrollsTable.end() ? 0 : shard_itr->bankroll.amount;
+  if (amount == previous_amount) {
+    return;
+  }
+  
+  const poolStruct& pool = getPool(pool_id);
+  if (shard_itr == shardBankrollsTable.end()) {
+    shardBankrollsTable.emplace(_self, [&](auto& s) {
+      s.shard = shard;
+      s.bankroll = asset(amount, pool.bankroll.symbol);
+    });
+  } else if (amount == 0) {
+    shardBankrollsTable.erase(shard_itr);
+  } else {
+    shardBankrollsTable.modify(shard_itr, same_payer, [&](auto& s) {
+      s.bankroll.amount = amount;
+    });
+  }
+  
+  auto total_itr = shardTotalsTable.find(pool_id);
+  if (total_itr == shardTotalsTable.end()) {
+    shardTotalsTable.emplace(_self, [&](auto& t) {
+      t.pool_id = pool_id;
+      t.bankroll = amount - previous_amount;
+    });
+  } else {
+    shardTotalsTable.modify(total_itr, same_payer, [&](auto& t) {
+      t.bankroll += amount - previous_amount;
+    });
+  }
+}
+
+
+
+
+/**
+ * Private function to erase all bets of a roll, including its mask bets
+ * Because of the bet keys, the bets of a roll are one consecutive range of the bets table
+ * 
+ * @param roll_id - The id of the roll to erase the bets of
+ */
+void pinkbankroll::eraseRollBets(uint64_t roll_id) {
+  auto bet_itr = betsTable.lower_bound(getBetKey(roll_id, 0));
+  while (bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id) {
+    //erase returns iterator poiting to next entry
+    bet_itr = betsTable.erase(bet_itr);
+  }
+  
+  auto mask_bet_itr = maskBetsTable.lower_bound(getBetKey(roll_id, 0));
+  while (mask_bet_itr != maskBetsTable.end() && mask_bet_itr->get_roll_id() == roll_id) {
+    mask_bet_itr = maskBetsTable.erase(mask_bet_itr);
+  }
+}
+
+
+
+
+/**
+ * Calculates the exact variance of the bets of a roll (see getRequiredBankroll). The variances of its draws are added up
+ * 
+ * @param roll - The roll to calculate the variance of
+ * @param total_bets_collected - The total amount collected from the bets of each draw, = total_quantity_bet - (rake + fees)
+ * @param bet_counts - The number of ranges that the bets of each draw add. Every range of a mask bet counts like a separate bet
+ */
+double pinkbankroll::getRollVariance(const rollStruct& roll, std::vector<uint64_t>& total_bets_collected, std::vector<uint32_t>& bet_counts) {
+  //Single draw rolls with a common max result use the specialized FixedRanges, see getFixedVariance
+  double roll_variance = 0;
+  bool fixed_variance = roll.draw_count == 1 && getFixedVariance(roll.max_result, bet_counts[0], total_bets_collected[0], [&](auto& ranges) {
+    bool inserted = true;
+    forEachBet(roll, [&](const betStruct& bet) {
+      inserted = inserted && ranges.insertBet(bet.get_lower_bound(), bet.get_upper_bound(), bet.amount * bet.get_multiplier() / 1000);
+    });
+    forEachMaskBet(roll, [&](const maskBetStruct& bet) {
+      forEachInterval(bet, [&](uint32_t lower_bound, uint32_t upper_bound) {
+        inserted = inserted && ranges.insertBet(lower_bound, upper_bound, bet.amount * bet.multiplier / 1000);
+      });
+    });
+    return inserted;
+  }, roll_variance);
+  
+  if (!fixed_variance) {
+    //Every roll is evaluated, so the ranges are built with ExposureIndex, which doesn't grow quadratically with the bets like ChainedRange
+    std::vector<ExposureIndex> indices(roll.draw_count, ExposureIndex(roll.max_result));
+    forEachBet(roll, [&](const betStruct& bet) {
+      indices[bet.get_draw_index()].addBetBounds(bet.get_lower_bound(), bet.get_upper_bound());
+    });
+    forEachMaskBet(roll, [&](const maskBetStruct& bet) {
+      forEachInterval(bet, [&](uint32_t lower_bound, uint32_t upper_bound) {
+        indices[bet.draw_index].addBetBounds(lower_bound, upper_bound);
+      });
+    });
+    for (ExposureIndex& index : indices) {
+      index.build();
+    }
+    forEachBet(roll, [&](const betStruct& bet) {
+      indices[bet.get_draw_index()].insertBet(bet.get_lower_bound(), bet.get_upper_bound(), bet.amount * bet.get_multiplier() / 1000);
+    });
+    forEachMaskBet(roll, [&](const maskBetStruct& bet) {
+      forEachInterval(bet, [&](uint32_t lower_bound, uint32_t upper_bound) {
+        indices[bet.draw_index].insertBet(lower_bound, upper_bound, bet.amount * bet.multiplier / 1000);
+      });
+    });
+    for (uint32_t draw_index = 0; draw_index < roll.draw_count; draw_index++) {
+      roll_variance += indices[draw_index].getVariance(total_bets_collected[draw_index]);
+    }
+  }
+  //Ranges with a negative maxBetFactor can make the variance negative
+  return std::max(roll_variance, 0.0);
+}
+
+
+
+
+/**
+ * Private function to release the variance that a roll locked in its pool when it was started, see handleStartRoll
+ * 
+ * @param roll - The paid roll that received its result or was rejected
+ */
+void pinkbankroll::unlockRoll(const rollStruct& roll) {
+  poolStruct& pool = modifyPool(roll.pool_id);
+  pool.locked_variance -= roll.locked_variance;
+  pool.paid_rolls -= 1;
+  if (pool.paid_rolls == 0) {
+    //Adding and subtracting the variances of the rolls can leave rounding errors
+    pool.locked_variance = 0;
+  }
+}
+
+
+
+
+/**
+ * Private function to add an amount to the outstanding payout of an account, which it can withdraw with payoutbet or poolpayout
+ * 
+ * @param payoutsTable - The payouts table of the pool of the amount, see getPayoutsTable
+ */
+void pinkbankroll::creditPayout(payouts_t& payoutsTable, name recipient, asset quantity) {
+  auto payouts_itr = payoutsTable.find(recipient.value);
+  if (payouts_itr != payoutsTable.end()) {
+    payoutsTable.modify(payouts_itr, _self, [&](auto& p) {
+      p.outstanding_payout += quantity;
+    });
+  } else {
+    payoutsTable.emplace(_self, [&](auto& p){
+      p.bettor = recipient;
+      p.outstanding_payout = quantity;
+    });
+  }
+}
+
+
+
+
+/**
+ * Returns the primary key of a bet in the bets table
+ * 
+ * @param roll_id - The id of the roll the bet belongs to
+ * @param bet_id - The id of the bet within the roll (< 65536)
+ */
+uint64_t pinkbankroll::getBetKey(uint64_t roll_id, uint64_t bet_id) {
+  return roll_id << 16 | bet_id;
+}
+
+
+
+
+/**
+ * Packs the bounds, the multiplier and the draw index of a bet into a single value, see betStruct
+ * 
+ * @param lower_bound - The lower bound of the bet (< 2^20)
+ * @param upper_bound - The upper bound of the bet (< 2^20)
+ * @param multiplier - The multiplier of the bet x1000 (< 2^18)
+ * @param draw_index - The index of the draw that the bet is on (< 64)
+ */
+uint64_t pinkbankroll::packBet(uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint32_t draw_index) {
+  check(upper_bound <= MAX_PACKED_BOUND && multiplier <= MAX_PACKED_MULTIPLIER && draw_index < MAX_DRAW_COUNT,
+  "the bet can't be packed");
+  return (uint64_t)multiplier | (uint64_t)lower_bound << 18 | (uint64_t)upper_bound << 38 | (uint64_t)draw_index << 58;
+}
+
+
+
+
+/**
+ * Returns the result 1 <= result <= max_result of a draw of a roll
+ * The first draw uses the first 128 bits of the random value, the same as rolls with a single draw always did
+ * The other draws use the first 128 bits of the sha256 hash of the random value and the draw index
+ * 
+ * @param random_value - The random value of the roll, as received from the rng oracle
+ * @param draw_index - The index of the draw
+ * @param max_result - The max result of the roll
+ */
+uint32_t pinkbankroll::getDrawResult(checksum256 random_value, uint32_t draw_index, uint32_t max_result) {
+  uint128_t random_number;
+  if (draw_index == 0) {
+    random_number = random_value.get_array()[0];
+  } else {
+    std::vector<char> draw_data = pack(std::make_tuple(random_value, draw_index));
+    random_number = sha256(draw_data.data(), draw_data.size()).get_array()[0];
+  }
+  return getRollResult(random_number, max_result);
+}
+
+
+
+
+/**
+ * Returns the stats of the contract. The stats singleton is only read once per action
+ */
+const pinkbankroll::statsStruct& pinkbankroll::getStats() {
+  if (!statsLoaded) {
+    statsCache = statsTable.get();
+    statsLoaded = true;
+  }
+  return statsCache;
+}
+
+
+
+
+/**
+ * Returns the stats of the contract to be modified
+ * All modifications are written back with a single write when the action ends, see ~pinkbankroll
+ */
+pinkbankroll::statsStruct& pinkbankroll::modifyStats() {
+  getStats();
+  statsDirty = true;
+  return statsCache;
+}
+
+
+
+
+/**
+ * Returns a bankroll pool. The pool that was used last is only read once per action
+ * The WAX pool (pool_id 0) is not stored in the pools table, but uses the bankroll in the stats
+ * 
+ * @param pool_id - The id of the pool
+ */
+const pinkbankroll::poolStruct& pinkbankroll::getPool(uint64_t pool_id) {
+  if (poolLoaded && poolCache.pool_id == pool_id) {
+    return poolCache;
+  }
+  flushPool();
+  if (pool_id == 0) {
+    const statsStruct& stats = getStats();
+    poolCache = poolStruct{0, "eosio.token"_n, stats.bankroll, stats.share_supply.value(), stats.locked_variance.value(), stats.paid_rolls.value()};
+  } else {
+    poolCache = poolsTable.get(pool_id, "no pool with this id exists");
+  }
+  poolLoaded = true;
+  return poolCache;
+}
+
+
+
+
+/**
+ * Returns a bankroll pool to be modified
+ * The modifications are written back when another pool is used or when the action ends, see flushPool
+ * 
+ * @param pool_id - The id of the pool
+ */
+pinkbankroll::poolStruct& pinkbankroll::modifyPool(uint64_t pool_id) {
+  getPool(pool_id);
+  poolDirty = true;
+  return poolCache;
+}
+
+
+
+
+/**
+ * Writes the cached pool back, if it was modified. The fields of the WAX pool are written to the stats
+ */
+void pinkbankroll::flushPool() {
+  if (!poolDirty) {
+    return;
+  }
+  if (poolCache.pool_id == 0) {
+    statsStruct& stats = modifyStats();
+    stats.bankroll = poolCache.bankroll;
+    stats.share_supply = poolCache.share_supply;
+    stats.locked_variance = poolCache.locked_variance;
+    stats.paid_rolls = poolCache.paid_rolls;
+  } else {
+    poolsTable.modify(poolsTable.find(poolCache.pool_id), same_payer, [&](auto& p) {
+      p.bankroll = poolCache.bankroll;
+      p.share_supply = poolCache.share_supply;
+      p.locked_variance = poolCache.locked_variance;
+      p.paid_rolls = poolCache.paid_rolls;
+    });
+  }
+  poolDirty = false;
+}
+
+
+
+
+/**
+ * Returns the payouts table of a pool. The payouts of the WAX pool use the contract as scope, the other pools use their pool_id
+ * 
+ * @param pool_id - The id of the pool
+ */
+pinkbankroll::payouts_t pinkbankroll::getPayoutsTable(uint64_t pool_id) {
+  return payouts_t(_self, pool_id == 0 ? _self.value : pool_id);
+}
+
+
+
+
+/**
+ * Returns the accrued fees table of a pool. Uses the same scopes as the payouts tables
+ * 
+ * @param pool_id - The id of the pool
+ */
+pinkbankroll::fees_t pinkbankroll::getFeesTable(uint64_t pool_id) {
+  return fees_t(_self, pool_id == 0 ? _self.value : pool_id);
+}
+
+
+
+
+/**
+ * Writes the cached pool and the stats back, if they were modified during the action
+ */
+pinkbankroll::~pinkbankroll() {
+  flushPool();
+  if (statsDirty) {
+    statsTable.set(statsCache, _self);
+  }
 }
 
 
@@ -623,6 +1884,28 @@ ACTION pinkbankroll::notifyresult(name creator, uint64_t creator_id, uint32_t re
 
 
 
+/**
+ * Notifies the creator of a roll with multiple draws of the results of all draws, in addition to notifyresult
+ * The first result is the same result that notifyresult and loggetrand contain
+ */
+ACTION pinkbankroll::notifydraws(name creator, uint64_t creator_id, std::vector<uint32_t> results) {
+  require_auth(_self);
+  require_recipient(creator);
+}
+
+
+
+/**
+ * Notifies the creator of a roll with external bets that the roll was rejected without a result, see receiverand
+ * The refund has been credited to the payouts of the creator and can be claimed with payoutbet or poolpayout
+ */
+ACTION pinkbankroll::notifyreject(name creator, uint64_t creator_id, asset refund) {
+  require_auth(_self);
+  require_recipient(creator);
+}
+
+
+
 //Only for external logging
   
 ACTION pinkbankroll::logannounce(uint64_t roll_id, name creator, uint64_t creator_id, uint32_t max_result, name rake_recipient) {
@@ -633,6 +1916,10 @@ ACTION pinkbankroll::logbet(uint64_t roll_id, uint64_t bet_id, name bettor, asse
   require_auth(_self);
 }
 
+ACTION pinkbankroll::logmaskbet(uint64_t roll_id, uint64_t bet_id, name bettor, asset quantity, std::vector<uint64_t> result_mask, uint32_t multiplier, uint64_t random_seed, uint32_t draw_index) {
+  require_auth(_self);
+}
+
 ACTION pinkbankroll::logstartroll(uint64_t roll_id, name creator, uint64_t creator_id) {
   require_auth(_self);
 }
@@ -641,6 +1928,10 @@ ACTION pinkbankroll::loggetrand(uint64_t roll_id, uint32_t result, asset bankrol
   require_auth(_self);
 }
 
+ACTION pinkbankroll::logreject(uint64_t roll_id, name creator, uint64_t creator_id, asset refund) {
+  require_auth(_self);
+}
+
 ACTION pinkbankroll::logbrchange(asset change, std::string message, asset new_bankroll) {
   require_auth(_self);
 }
@@ -0,0 +1,186 @@
+#include <stdint.h>
+#include <array>
+
+/**
+ * Games with a fixed set of bet types, that can be played with the #play memo
+ *
+ * A game is declared as a list of named bet types, each with a fixed range of results and a fixed multiplier.
+ * The list is compiled into a table of GameBetTypes, which also hold the values that the contract would otherwise
+ * calculate for every bet. Every bet type is checked with a static_assert, so a bet only needs to look up its type
+ * and doesn't have to be checked with checkBetParameters anymore.
+ */
+
+
+/**
+ * A bet type as it is declared in a game. Bets of this type win if lower_bound <= result <= upper_bound
+ */
+struct BetType {
+  const char* name;
+  uint32_t lower_bound;
+  uint32_t upper_bound;
+  uint32_t multiplier;  //x1000 (multiplier 2000 => 2x payout)
+};
+
+
+/**
+ * Square root that can be evaluated at compile time, using Newton's method
+ */
+constexpr double constexprSqrt(double value) {
+  double estimate = value > 1.0 ? value : 1.0;
+  //Newton's method can end up alternating between the two closest values, so the number of steps is limited
+  for (int i = 0; i < 200; i++) {
+    double next = 0.5 * (estimate + value / estimate);
+    if (next == estimate) {
+      break;
+    }
+    estimate = next;
+  }
+  return estimate;
+}
+
+
+/**
+ * A bet type together with the values that every bet of this type needs, calculated at compile time
+ */
+struct GameBetType {
+  uint32_t max_result = 0;
+  uint32_t lower_bound = 0;
+  uint32_t upper_bound = 0;
+  uint32_t multiplier = 0;
+  double odds = 0;
+  double ev = 0;    //Calculated the same way as in getCollectedAmount, so that the running sums of the rolls stay the same
+  double risk = 0;  //odds / maxBetFactor, see getRangeVariance
+  
+  uint64_t getCollectedAmount(uint64_t amount) const {
+    return (int64_t)((double)amount * (ev + 0.007));
+  }
+  
+  /**
+   * Returns the required bankroll of a roll that only has a single bet of this type, see getSingleBetRequiredBankroll
+   */
+  uint64_t getRequiredBankroll(uint64_t amount) const {
+    uint64_t payout = amount * multiplier / 1000;
+    uint64_t collected = getCollectedAmount(amount);
+    if (payout <= collected) {
+      return 0;
+    }
+    double effectivePayout = (double)(payout - collected) + (double)payout * odds;
+    return (uint64_t)(effectivePayout * risk * 125.0);
+  }
+};
+
+
+/**
+ * Returns true if bets of the bet type would pass checkBetParameters and fit into the packed bets
+ * Uses integers instead of the doubles of checkBetParameters, so that it can be evaluated at compile time
+ */
+constexpr bool isValidBetType(const BetType& betType, uint32_t maxResult) {
+  uint64_t range = betType.upper_bound - betType.lower_bound + 1;
+  return betType.lower_bound >= 1
+    && betType.lower_bound <= betType.upper_bound
+    && betType.upper_bound <= maxResult
+    && betType.upper_bound <= 0xFFFFF  //MAX_PACKED_BOUND
+    && betType.multiplier > 1000
+    && betType.multiplier <= 0x3FFFF  //MAX_PACKED_MULTIPLIER
+    //odds >= 0.005
+    && range * 200 >= maxResult
+    //ev <= 0.99
+    && range * betType.multiplier <= (uint64_t)maxResult * 990;
+}
+
+
+constexpr GameBetType compileBetType(const BetType& betType, uint32_t maxResult) {
+  GameBetType gameBetType;
+  gameBetType.max_result = maxResult;
+  gameBetType.lower_bound = betType.lower_bound;
+  gameBetType.upper_bound = betType.upper_bound;
+  gameBetType.multiplier = betType.multiplier;
+  gameBetType.odds = (double)(betType.upper_bound - betType.lower_bound + 1) / (double)maxResult;
+  gameBetType.ev = (double)betType.multiplier / 1000.0 * (double)(betType.upper_bound - betType.lower_bound + 1) / (double)maxResult;
+  double maxBetFactor = 5.0 / constexprSqrt((1.0 / gameBetType.odds) - 1.0) - 0.2;
+  gameBetType.risk = gameBetType.odds / maxBetFactor;
+  return gameBetType;
+}
+
+
+/**
+ * A game compiled from its bet types. The id of a bet type is its index in the declaration
+ */
+template<uint32_t MaxResult, uint32_t TypeCount>
+class Game {
+  public:
+  
+  std::array<GameBetType, TypeCount> betTypes;
+  bool valid = true;
+  
+  constexpr Game(const std::array<BetType, TypeCount>& declaredTypes) : betTypes() {
+    for (uint32_t i = 0; i < TypeCount; i++) {
+      valid = valid && isValidBetType(declaredTypes[i], MaxResult);
+      betTypes[i] = compileBetType(declaredTypes[i], MaxResult);
+    }
+  }
+  
+  const GameBetType* getBetType(uint32_t betTypeId) const {
+    return betTypeId < TypeCount ? &betTypes[betTypeId] : nullptr;
+  }
+};
+
+
+//Game 0: Coinflip
+constexpr Game<2, 2> COINFLIP({{
+  {"heads", 1, 1, 1980},
+  {"tails", 2, 2, 1980}
+}});
+static_assert(COINFLIP.valid, "invalid bet type in COINFLIP");
+
+
+//Game 1: A single die
+constexpr Game<6, 8> DICE({{
+  {"one", 1, 1, 5940},
+  {"two", 2, 2, 5940},
+  {"three", 3, 3, 5940},
+  {"four", 4, 4, 5940},
+  {"five", 5, 5, 5940},
+  {"six", 6, 6, 5940},
+  {"low", 1, 3, 1980},
+  {"high", 4, 6, 1980}
+}});
+static_assert(DICE.valid, "invalid bet type in DICE");
+
+
+/**
+ * Returns the bet types of a single zero roulette. The result 1 is the zero, the result n + 1 is the number n
+ * The ids 0 - 36 are the bets on the single numbers, followed by the bets on ranges of numbers
+ */
+constexpr std::array<BetType, 42> getRouletteBetTypes() {
+  std::array<BetType, 42> betTypes = {};
+  for (uint32_t number = 0; number <= 36; number++) {
+    betTypes[number] = {"straight", number + 1, number + 1, 36000};
+  }
+  betTypes[37] = {"low", 2, 19, 2000};
+  betTypes[38] = {"high", 20, 37, 2000};
+  betTypes[39] = {"first dozen", 2, 13, 3000};
+  betTypes[40] = {"second dozen", 14, 25, 3000};
+  betTypes[41] = {"third dozen", 26, 37, 3000};
+  return betTypes;
+}
+
+//Game 2: Single zero roulette
+constexpr Game<37, 42> ROULETTE(getRouletteBetTypes());
+static_assert(ROULETTE.valid, "invalid bet type in ROULETTE");
+
+
+/**
+ * Returns the compiled bet type with the given ids, or nullptr if there is no such bet type
+ *
+ * @param gameId - The id of the game, see the declarations above
+ * @param betTypeId - The id of the bet type within the game
+ */
+const GameBetType* getGameBetType(uint32_t gameId, uint32_t betTypeId) {
+  switch (gameId) {
+    case 0: return COINFLIP.getBetType(betTypeId);
+    case 1: return DICE.getBetType(betTypeId);
+    case 2: return ROULETTE.getBetType(betTypeId);
+    default: return nullptr;
+  }
+}
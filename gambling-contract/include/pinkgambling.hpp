@@ -6,24 +6,55 @@
 
 using namespace eosio;
 
+//Defined in bankrollmanagement.hpp
+class ChainedRange;
+class ExposureIndex;
+
 CONTRACT pinkgambling : public contract {
   public:
     using contract::contract;
     pinkgambling(name receiver, name code, datastream<const char*> ds):contract(receiver, code, ds),
     rollsTable(receiver, receiver.value),
-    statsTable(receiver, receiver.value)
+    betsTable(receiver, receiver.value),
+    statsTable(receiver, receiver.value),
+    refundsTable(receiver, receiver.value),
+    batchesTable(receiver, receiver.value),
+    batchConfigTable(receiver, receiver.value),
+    shardsTable(receiver, receiver.value)
     {}
     
     ACTION init();
     
     ACTION startroll(uint64_t roll_id);
+    ACTION startdue(uint32_t max_count);
+    ACTION claimrefund(name bettor);
+    ACTION migraterolls(uint32_t max_count);
+    ACTION setbatching(bool enabled, uint32_t window_ms, uint32_t max_bets);
+    ACTION flushbatches(uint32_t max_count);
+    ACTION setshard(name account, bool registered);
+    
+    [[eosio::action]] asset maxbet(uint64_t roll_id, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier);
+    [[eosio::action]] asset maxquickbet(uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier);
+    
+    //Total payout of the bets of a roll if the result is within the bounds, see getliability
+    struct liabilityRange {
+      uint32_t lower_bound;
+      uint32_t upper_bound;
+      uint64_t payout;
+    };
+    [[eosio::action]] std::vector<liabilityRange> getliability(uint64_t roll_id);
     
     [[eosio::on_notify("eosio.token::transfer")]] void receivetransfer(name from, name to, asset quantity, std::string memo);
-    [[eosio::on_notify("roll.pink::notifyresult")]] void receivenotifyresult(name creator, uint64_t creator_id, uint32_t result);
+    [[eosio::on_notify("*::notifyresult")]] void receivenotifyresult(name creator, uint64_t creator_id, uint32_t result);
+    [[eosio::on_notify("*::notifyreject")]] void receivenotifyreject(name creator, uint64_t creator_id, asset refund);
   
     ACTION logbet(uint64_t roll_id, uint64_t cycle_number, uint64_t bet_id, name bettor, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t client_seed);
+    //Identifier of a quick bet that was added to a batch roll
+    ACTION logbatchbet(uint64_t roll_id, uint64_t bet_id, uint64_t identifier);
     ACTION logresult(uint64_t roll_id, uint64_t cycle_number, uint32_t max_result, name rake_recipient, uint32_t roll_result, uint64_t identifier, uint32_t cycle_time);
     ACTION logreduction(uint64_t roll_id, uint64_t cycle_number, double reduction);
+    //Results of consecutive idle cycles, starting at first_cycle_number
+    ACTION logidle(uint64_t roll_id, uint64_t first_cycle_number, uint32_t max_result, name rake_recipient, uint32_t cycle_time, std::vector<uint32_t> results);
   
   private:
     
@@ -37,13 +68,68 @@ CONTRACT pinkgambling : public contract {
       time_point last_cycle;  //0 when roll is not cyclic
       time_point last_player_joined; //0 when roll is not cyclic
       uint32_t cycle_time;    //0 when roll is not cyclic
+      uint32_t bet_scale;     //Part of each bet that is actually bet x 1000000. Only lower when the bets had to be reduced
+      uint32_t bet_count;     //Number of bets in the current roll/ cycle
+      uint64_t payout_sum;    //Sum of the payouts of the bets in the current roll/ cycle
+      uint64_t collected_sum; //Sum of the amounts collected from the bets in the current roll/ cycle, see insertRollBets
+      name shard;             //The bankroll contract that the current roll/ cycle was sent to, see getShard
       
       uint64_t primary_key() const { return roll_id; }
+      //Time in microseconds at which the next cycle can be started. Rolls that can't be started manually are sorted to the end
+      uint64_t get_next_due() const {
+        if (cycle_number == 0 || waiting_for_result) {
+          return UINT64_MAX;
+        }
+        return last_cycle.time_since_epoch().count() + (uint64_t)cycle_time * 1000000;
+      }
     };
-    typedef multi_index<"rolls"_n, rollStruct> rolls_t;
+    typedef multi_index<
+    "rolls"_n,
+    rollStruct,
+    indexed_by<"nextdue"_n, const_mem_fun<rollStruct, uint64_t, &rollStruct::get_next_due>>>
+    rolls_t;
+    
+    //Rolls as they were stored before bet_scale and the fields after it were added, only used to migrate existing rolls with migraterolls
+    //bet_scale is only present in rolls that already have the current layout
+    struct legacyRollStruct {
+      uint64_t roll_id;
+      uint32_t max_result;
+      name rake_recipient;
+      bool waiting_for_result;
+      uint64_t identifier;
+      uint64_t cycle_number;
+      time_point last_cycle;
+      time_point last_player_joined;
+      uint32_t cycle_time;
+      binary_extension<uint32_t> bet_scale;
+      
+      uint64_t primary_key() const { return roll_id; }
+    };
+    typedef multi_index<"rolls"_n, legacyRollStruct> legacy_rolls_t;
 
     
+    //The bets of all rolls are stored in a single table, keyed by roll_id << 16 | bet_id
+    //so that the bets of a roll are stored next to each other, see getBetKey
+    //The symbol of the amount is always WAX. The bounds and the multiplier are packed into packed_bet, see packBet
     TABLE betStruct {
+      uint64_t bet_key;
+      name bettor;
+      int64_t amount;
+      uint64_t packed_bet;  //multiplier: bits 0-17, lower_bound: bits 18-37, upper_bound: bits 38-57
+      uint64_t random_seed;
+      
+      uint64_t primary_key() const { return bet_key; }
+      uint64_t get_roll_id() const { return bet_key >> 16; }
+      uint64_t get_bet_id() const { return bet_key & 0xFFFF; }
+      asset get_quantity() const { return asset(amount, symbol("WAX", 8)); }
+      uint32_t get_multiplier() const { return packed_bet & 0x3FFFF; }
+      uint32_t get_lower_bound() const { return (packed_bet >> 18) & 0xFFFFF; }
+      uint32_t get_upper_bound() const { return (packed_bet >> 38) & 0xFFFFF; }
+    };
+    typedef multi_index<"packedbets"_n, betStruct> bets_t;
+    
+    //Bets as they were stored before packedbets, with one scope per roll. Only used to migrate existing bets with migraterolls
+    struct legacyBetStruct {
       uint64_t bet_id;
       name bettor;
       asset quantity;
@@ -54,7 +140,7 @@ CONTRACT pinkgambling : public contract {
       
       uint64_t primary_key() const { return bet_id; }
     };
-    typedef multi_index<"rollbets"_n, betStruct> rollBets_t;
+    typedef multi_index<"rollbets"_n, legacyBetStruct> legacy_bets_t;
     
     
     TABLE statsStruct {
@@ -65,22 +151,114 @@ CONTRACT pinkgambling : public contract {
     typedef multi_index<"stats"_n, statsStruct> stats_t_for_abi;
     
     
+    TABLE refundStruct {
+      name bettor;
+      asset balance;
+      
+      uint64_t primary_key() const { return bettor.value; }
+    };
+    typedef multi_index<"refunds"_n, refundStruct> refunds_t;
+    
+    
+    //Open batch rolls that quick bets with the same rake recipient are added to, see quickBet
+    TABLE batchStruct {
+      name rake_recipient;
+      uint64_t roll_id;
+      time_point opened;  //Time at which the first bet was added to the batch
+      
+      uint64_t primary_key() const { return rake_recipient.value; }
+      uint64_t get_opened() const { return opened.time_since_epoch().count(); }
+    };
+    typedef multi_index<
+    "batches"_n,
+    batchStruct,
+    indexed_by<"opened"_n, const_mem_fun<batchStruct, uint64_t, &batchStruct::get_opened>>>
+    batches_t;
+    
+    //Quick bets are only batched after batching has been enabled with setbatching
+    TABLE batchConfigStruct {
+      bool enabled = false;
+      uint32_t window_ms = 0;  //Time after which a batch is sent with the next bet or by flushbatches
+      uint32_t max_bets = 1;   //Number of bets after which a batch is sent immediately
+    };
+    typedef singleton<"batchconfig"_n, batchConfigStruct> batch_config_t;
+    // https://github.com/EOSIO/eosio.cdt/issues/280
+    typedef multi_index<"batchconfig"_n, batchConfigStruct> batch_config_t_for_abi;
+    
+    
+    //Bankroll contracts that rolls can be sent to, see getShard. If there are none, roll.pink is used
+    TABLE shardStruct {
+      name account;
+      
+      uint64_t primary_key() const { return account.value; }
+    };
+    typedef multi_index<"shards"_n, shardStruct> shards_t;
+    
+    
     //This is needed to get the current bankroll of the bankroll contract
     struct bankrollStatsStruct {
       asset bankroll = asset(0, symbol("WAX", 8));
       uint64_t current_roll_id = 0;
+      bool paused = false;
+      binary_extension<asset> share_supply = asset(0, symbol("PINK", 4));
+      binary_extension<uint64_t> current_withdrawal_id = 0;
+      binary_extension<double> locked_variance = 0.0;
+      binary_extension<uint32_t> paid_rolls = 0;
     };
     typedef singleton<"stats"_n, bankrollStatsStruct> bankroll_stats_t;
     
+    //This is needed to check if this contract is registered to use external bets in the bankroll contract
+    struct bankrollExtCreatorStruct {
+      name creator;
+      
+      uint64_t primary_key() const { return creator.value; }
+    };
+    typedef multi_index<"extcreators"_n, bankrollExtCreatorStruct> bankroll_ext_creators_t;
+    
     
     rolls_t rollsTable;
+    bets_t betsTable;
     stats_t statsTable;
+    refunds_t refundsTable;
+    batches_t batchesTable;
+    batch_config_t batchConfigTable;
+    shards_t shardsTable;
+    
+    //Per action cache of the shard with the most free bankroll, see getShard
+    name shardCache;
+    asset shardBankrollCache;
+    bool shardLoaded = false;
   
+    bool startCycle(uint64_t roll_id);
     void createCycle(uint32_t max_result, name rake_recipient, uint32_t cycle_time);
     void quickBet(asset quantity, name bettor, uint32_t multiplier, uint32_t lower_bound, uint32_t upper_bound, name rake_recipient, uint64_t identifier, uint64_t random_seed);
+    void batchQuickBet(asset quantity, name bettor, uint32_t multiplier, uint32_t lower_bound, uint32_t upper_bound, name rake_recipient, uint64_t identifier, uint64_t random_seed);
+    uint64_t createQuickRoll(name rake_recipient, uint64_t identifier, uint32_t max_result);
+    void playGame(asset quantity, name bettor, uint32_t game_id, uint32_t bet_type_id, name rake_recipient, uint64_t identifier, uint64_t random_seed);
+    void flushBatch(name rake_recipient);
+    bool fitsIntoRoll(uint64_t roll_id, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier);
     void addBet(asset quantity, uint64_t roll_id, name bettor, uint32_t multiplier, uint32_t lower_bound, uint32_t upper_bound, uint64_t random_seed);
-    void sendRoll(uint64_t roll_id);
+    uint64_t storeBet(rolls_t::const_iterator roll_itr, asset quantity, name bettor, uint32_t multiplier, uint32_t lower_bound, uint32_t upper_bound, uint64_t random_seed, uint64_t collected);
+    void checkBetParameters(uint32_t max_result, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier);
+    bool sendRollWithinBankroll(uint64_t roll_id);
+    void sendRoll(uint64_t roll_id, uint32_t bet_scale, asset required_bankroll);
     void handleResult(uint64_t roll_id, uint32_t result);
+    void creditRefund(name bettor, asset quantity);
+    void eraseRollBets(uint64_t roll_id);
+    void refundRollBets(uint64_t roll_id);
     
+    asset getBankroll();
+    name getShard();
+    asset getFreeBankroll(name shard);
+    void reserveBankroll(asset required_bankroll);
     asset calculateRollRequiredBankroll(uint64_t roll_id);
+    uint64_t insertRollBets(uint64_t roll_id, ChainedRange& firstRange);
+    ExposureIndex getExposureIndex(uint64_t roll_id, uint32_t max_result);
+    static uint64_t getCollectedAmount(uint64_t amount, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint32_t max_result);
+    asset getMaxBetQuantity(ChainedRange& firstRange, uint64_t total_bets_collected, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t min_amount);
+    static uint64_t getMinBetAmount(uint64_t cycle_number, uint64_t bet_id);
+    static asset getScaledQuantity(asset quantity, uint32_t bet_scale);
+    static uint64_t getBetKey(uint64_t roll_id, uint64_t bet_id);
+    static uint64_t packBet(uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier);
+    static uint32_t getIdleResult(uint64_t roll_id, uint64_t cycle_number, uint32_t max_result);
 };
\ No newline at end of file
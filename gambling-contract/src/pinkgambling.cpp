@@ -1,7 +1,18 @@
 #include <pinkgambling.hpp>
 #include <bankrollmanagement.hpp>
+#include <games.hpp>
 
 static constexpr symbol CORE_SYMBOL = symbol("WAX", 8);
+//Upper limit of idle cycles that are skipped within one call, to keep the size of the logidle action bounded
+static constexpr uint64_t MAX_IDLE_CYCLES = 1000;
+//bet_scale of a roll whose bets are not reduced
+static constexpr uint32_t BET_SCALE_PRECISION = 1000000;
+static constexpr uint32_t QUICK_BET_MAX_RESULT = 10000;
+//Upper limit of the bets in a batch roll. Every bet added to a batch reads all bets of the batch, see addBet
+static constexpr uint32_t MAX_BATCH_BETS = 50;
+//Limits of the fields in the packed bets, see betStruct
+static constexpr uint32_t MAX_PACKED_BOUND = 0xFFFFF;
+static constexpr uint32_t MAX_PACKED_MULTIPLIER = 0x3FFFF;
 
 //Only needs to be called once after contract creation
 ACTION pinkgambling::init() {
@@ -16,11 +27,6 @@ ACTION pinkgambling::init() {
  * This action can be called by anyone as soon as the roll specific cycle time
  * has passed since the last result was gotten
  * 
- * Note: When no bets have been placed, instead of calling the bankroll contract,
- * a pseudo random number is generated. This is done so that gambling apps can still show
- * results generated by the blockchain, even when nobody has bet, while keeping the cpu
- * cost relatively low
- * 
  * @param roll_id - The id of the roll to start
  */
 ACTION pinkgambling::startroll(uint64_t roll_id) {
@@ -34,60 +40,369 @@ ACTION pinkgambling::startroll(uint64_t roll_id) {
   check(roll_itr->last_cycle + microseconds(roll_itr->cycle_time * 1000000) <= current_time_point(),
   "not enough time has passed since the last result was received for this roll");
   
-  rollBets_t betsTable(_self, roll_id);
-  if (betsTable.begin() == betsTable.end()) {
-    //No bets have been placed, generating pseudo random number for efficiency
-    //Note: This is a really bad method to generate randomness, and can easily be predicted.
-    uint128_t pseudo_random_seed = uint128_t{roll_id} << 64 | roll_itr->cycle_number;
-    checksum256 random_value = sha256((char*)&pseudo_random_seed, 16);
-    const auto random_array = random_value.get_array();
-    //The first 128 bits of the random_value. The rest is not needed
-    uint128_t random_number = random_array[0];
-    uint32_t result = (random_number % roll_itr->max_result) + 1;
+  check(startCycle(roll_id),
+  "the bankroll can't accept any part of the bets of this cycle right now");
+}
+
+
+
+
+/**
+ * Action to start all cyclic rolls that are due, in the order they became due
+ * Like startroll, this can be called by anyone. It allows a single transaction to serve all cycles
+ * instead of having to call startroll for every cycle separately
+ * 
+ * Cycles whose bets the bankroll can't accept right now are skipped, so that they don't hold up the other due cycles
+ * They are left unchanged and stay due, so the next call retries them as soon as the bankroll can accept them
+ * 
+ * @param max_count - The maximum amount of due cycles to handle within this action
+ */
+ACTION pinkgambling::startdue(uint32_t max_count) {
+  check(max_count > 0,
+  "max_count has to be greater than 0");
+  
+  auto rolls_by_next_due = rollsTable.get_index<"nextdue"_n>();
+  uint64_t now = current_time_point().time_since_epoch().count();
+  
+  //The due rolls are collected before starting any of them, because starting a cycle changes its position in the index
+  //A roll that is still due afterwards (see MAX_IDLE_CYCLES, or skipped by startCycle) is therefore only handled once per call
+  std::vector<uint64_t> due_roll_ids;
+  for (auto roll_itr = rolls_by_next_due.begin(); roll_itr != rolls_by_next_due.end() && roll_itr->get_next_due() <= now && due_roll_ids.size() < max_count; roll_itr++) {
+    due_roll_ids.push_back(roll_itr->roll_id);
+  }
+  
+  check(!due_roll_ids.empty(),
+  "no cycle is due to be started");
+  
+  for (uint64_t roll_id : due_roll_ids) {
+    startCycle(roll_id);
+  }
+}
+
+
+
+
+/**
+ * Private function to start a cyclic roll, after it has been checked that the cycle is due
+ * 
+ * Note: When no bets have been placed, instead of calling the bankroll contract,
+ * pseudo random numbers are generated for all elapsed cycles at once. This is done so that gambling apps can still show
+ * results generated by the blockchain, even when nobody has bet, while keeping the cpu
+ * cost relatively low
+ * 
+ * @param roll_id - The id of the roll to start
+ * @return - false if the cycle has bets that the bankroll can't accept right now. The roll is left unchanged then
+ */
+bool pinkgambling::startCycle(uint64_t roll_id) {
+  auto roll_itr = rollsTable.find(roll_id);
+  
+  if (roll_itr->bet_count == 0) {
+    //No bets have been placed. All cycles that have elapsed since the last result are skipped at once,
+    //using a single row write and a single log. The pseudo random results are derived with getIdleResult
+    uint64_t cycle_duration = (uint64_t)roll_itr->cycle_time * 1000000;
+    uint64_t idle_cycles = (current_time_point() - roll_itr->last_cycle).count() / cycle_duration;
+    if (idle_cycles > MAX_IDLE_CYCLES) {
+      //The remaining cycles stay due and will be skipped by the next call
+      idle_cycles = MAX_IDLE_CYCLES;
+    }
+    
+    uint64_t first_cycle_number = roll_itr->cycle_number;
+    std::vector<uint32_t> results(idle_cycles);
+    for (uint64_t i = 0; i < idle_cycles; i++) {
+      results[i] = getIdleResult(roll_id, first_cycle_number + i, roll_itr->max_result);
+    }
+    
     rollsTable.modify(roll_itr, _self, [&](auto& r) {
-      r.waiting_for_result = true;
+      r.cycle_number += idle_cycles;
+      r.last_cycle += microseconds(idle_cycles * cycle_duration);
     });
-    handleResult(roll_id, result);
+    
+    action(
+      permission_level{_self, "active"_n},
+      _self,
+      "logidle"_n,
+      std::make_tuple(roll_id, first_cycle_number, roll_itr->max_result, roll_itr->rake_recipient, roll_itr->cycle_time, results)
+    ).send();
+    return true;
     
   } else {
     //At least one bet has been placed. Calling bankroll contract
+    return sendRollWithinBankroll(roll_id);
+  }
+}
+
+
+
+
+/**
+ * Pays out the refunds of a bettor. Refunds are credited when the bets of a cycle were too high for the bankroll
+ * and had to be reduced. Can be called by anyone, the WAX is always sent to the bettor
+ * 
+ * @param bettor - The account name of the bettor to pay the refunds to
+ */
+ACTION pinkgambling::claimrefund(name bettor) {
+  auto refund_itr = refundsTable.find(bettor.value);
+  check(refund_itr != refundsTable.end(),
+  "the account has no refunds");
+  
+  asset quantity = refund_itr->balance;
+  refundsTable.erase(refund_itr);
+  
+  action(
+    permission_level{_self, "active"_n},
+    "eosio.token"_n,
+    "transfer"_n,
+    std::make_tuple(_self, bettor, quantity, std::string("cycle bet refund"))
+  ).send();
+}
+
+
+
+
+/**
+ * @dev Rewrites the rolls that were stored before the bet scale, the running sums of the bets and the shard were added to them,
+ * and moves their bets from the rollbets table of each roll to the packedbets table
+ * Needs to be called in the same transaction as the contract update until all rolls have been rewritten,
+ * so that no roll is read with the old layout
+ * 
+ * The rolls are erased and emplaced again instead of being modified, because they aren't in the nextdue index yet
+ * 
+ * @param max_count - The max number of bets and rolls to move in this action. A roll is only rewritten after all of its bets have been moved
+ */
+ACTION pinkgambling::migraterolls(uint32_t max_count) {
+  require_auth(_self);
+  
+  legacy_rolls_t legacyRollsTable(_self, _self.value);
+  uint32_t migrated_count = 0;
+  auto legacy_itr = legacyRollsTable.begin();
+  while (migrated_count < max_count && legacy_itr != legacyRollsTable.end()) {
+    if (legacy_itr->bet_scale.has_value()) {
+      legacy_itr++;
+      continue;
+    }
+    
+    legacy_bets_t legacyBetsTable(_self, legacy_itr->roll_id);
+    auto bet_itr = legacyBetsTable.begin();
+    while (migrated_count < max_count && bet_itr != legacyBetsTable.end()) {
+      check(bet_itr->bet_id <= 0xFFFF,
+      "a roll can't have more than 65536 bets");
+      betsTable.emplace(_self, [&](betStruct &b) {
+        b.bet_key = getBetKey(legacy_itr->roll_id, bet_itr->bet_id);
+        b.bettor = bet_itr->bettor;
+        b.amount = bet_itr->quantity.amount;
+        b.packed_bet = packBet(bet_itr->lower_bound, bet_itr->upper_bound, bet_itr->multiplier);
+        b.random_seed = bet_itr->random_seed;
+      });
+      //erase returns iterator poiting to next entry
+      bet_itr = legacyBetsTable.erase(bet_itr);
+      migrated_count++;
+    }
+    if (bet_itr != legacyBetsTable.end()) {
+      //The remaining bets of the roll are moved in the next call
+      break;
+    }
     
-    // Checks if the roll is within the bankroll contract's bankroll management
-    // If not, all bets get reduced by the same factor so that the whole roll will be acceptable again
-    // All bettors will immediately get the WAX that won't be bet sent back to them
-    asset required_bankroll = calculateRollRequiredBankroll(roll_id);
-    bankroll_stats_t bankrollStatsTable("roll.pink"_n, "roll.pink"_n.value);
-    bankrollStatsStruct bankroll_stats = bankrollStatsTable.get();
+    legacyRollStruct legacy_roll = *legacy_itr;
+    //erase returns iterator poiting to next entry
+    legacy_itr = legacyRollsTable.erase(legacy_itr);
     
-    if (bankroll_stats.bankroll < required_bankroll) {
-      double refund_factor = 1.01 - ((double)bankroll_stats.bankroll.amount / (double)required_bankroll.amount);  // 1.01 instead of 1.00 because of possible rounding errors
-      std::string refund_factor_string = std::to_string(refund_factor * 100) + std::string("%");
+    rollsTable.emplace(_self, [&](auto& r) {
+      r.roll_id = legacy_roll.roll_id;
+      r.max_result = legacy_roll.max_result;
+      r.rake_recipient = legacy_roll.rake_recipient;
+      r.waiting_for_result = legacy_roll.waiting_for_result;
+      r.identifier = legacy_roll.identifier;
+      r.cycle_number = legacy_roll.cycle_number;
+      r.last_cycle = legacy_roll.last_cycle;
+      r.last_player_joined = legacy_roll.last_player_joined;
+      r.cycle_time = legacy_roll.cycle_time;
+      //Rolls that are already waiting for their result were sent unreduced to roll.pink
+      r.bet_scale = BET_SCALE_PRECISION;
+      r.shard = "roll.pink"_n;
       
-      for (auto bet_itr = betsTable.begin(); bet_itr != betsTable.end(); bet_itr++) {
-        uint64_t refund_amount = (uint64_t)((double)bet_itr->quantity.amount * refund_factor);
-        asset refund_quantity = asset(refund_amount, CORE_SYMBOL);
-        betsTable.modify(bet_itr, _self, [&](auto& b) {
-          b.quantity -= refund_quantity;
-        });
-        
-        action(
-          permission_level{_self, "active"_n},
-          "eosio.token"_n,
-          "transfer"_n,
-          std::make_tuple(_self, bet_itr->bettor, refund_quantity, std::string("The bets in the cycle were to high for the bankroll. Therefore ") + refund_factor_string + std::string(" of your bet were refunded. The rest will be bet normally. Note that this is done before the result gets computed."))
-        ).send();
+      //Same running sums as if the bets had been added with storeBet
+      r.bet_count = 0;
+      r.payout_sum = 0;
+      r.collected_sum = 0;
+      for (auto bet_itr = betsTable.lower_bound(getBetKey(r.roll_id, 0)); bet_itr != betsTable.end() && bet_itr->get_roll_id() == r.roll_id; bet_itr++) {
+        r.bet_count = bet_itr->get_bet_id() + 1;
+        r.payout_sum += bet_itr->amount * bet_itr->get_multiplier() / 1000;
+        r.collected_sum += getCollectedAmount(bet_itr->amount, bet_itr->get_lower_bound(), bet_itr->get_upper_bound(), bet_itr->get_multiplier(), r.max_result);
       }
-      
-      action(
-        permission_level{_self, "active"_n},
-        _self,
-        "logreduction"_n,
-        std::make_tuple(roll_id, roll_itr->cycle_number, refund_factor)
-      ).send();
+    });
+    migrated_count++;
+  }
+  
+  check(migrated_count > 0,
+  "there are no rolls left to migrate");
+}
+
+
+
+
+/**
+ * @dev Sets up batching of quick bets. When enabled, quick bets with the same rake recipient are added to a shared batch roll
+ * instead of each creating its own roll, so that all bets of the batch only need a single result from the bankroll contract
+ * 
+ * @param enabled - Whether new quick bets are batched
+ * @param window_ms - Time in milliseconds after which a batch is sent with its next bet, or by calling flushbatches
+ * @param max_bets - Number of bets after which a batch is sent immediately (1 <= max_bets <= 50)
+ */
+ACTION pinkgambling::setbatching(bool enabled, uint32_t window_ms, uint32_t max_bets) {
+  require_auth(_self);
+  
+  check(max_bets >= 1 && max_bets <= MAX_BATCH_BETS,
+  "max_bets must be between 1 and 50");
+  
+  batchConfigStruct config = batchConfigTable.get_or_default();
+  config.enabled = enabled;
+  config.window_ms = window_ms;
+  config.max_bets = max_bets;
+  batchConfigTable.set(config, _self);
+}
+
+
+
+
+/**
+ * Action to send all batch rolls whose window has passed, in the order they were opened
+ * Like startdue, this can be called by anyone. It makes sure that the bets of a batch are also sent when no other quick bets follow
+ * If batching has been disabled, all open batches can be sent
+ * 
+ * @param max_count - The maximum amount of batches to send within this action
+ */
+ACTION pinkgambling::flushbatches(uint32_t max_count) {
+  check(max_count > 0,
+  "max_count has to be greater than 0");
+  
+  batchConfigStruct config = batchConfigTable.get_or_default();
+  auto batches_by_opened = batchesTable.get_index<"opened"_n>();
+  
+  uint32_t flushed_count = 0;
+  while (flushed_count < max_count) {
+    //Flushing a batch erases it, so the first entry always is the oldest open batch
+    auto batch_itr = batches_by_opened.begin();
+    if (batch_itr == batches_by_opened.end()) {
+      break;
     }
-    
-    sendRoll(roll_id);
+    if (config.enabled && batch_itr->opened + microseconds((int64_t)config.window_ms * 1000) > current_time_point()) {
+      break;
+    }
+    flushBatch(batch_itr->rake_recipient);
+    flushed_count++;
+  }
+  
+  check(flushed_count > 0,
+  "no batch is due to be flushed");
+}
+
+
+
+
+/**
+ * @dev Registers/ unregisters a bankroll shard. Rolls are sent to the registered shard with the most free bankroll, see getShard
+ * Shards are accounts running the bankroll contract, which hold part of the bankroll each.
+ * The bankroll contract of a shard needs to be initialized before it can be registered
+ * 
+ * @param account - The account name of the shard
+ * @param registered - Whether rolls can be sent to the shard
+ */
+ACTION pinkgambling::setshard(name account, bool registered) {
+  require_auth(_self);
+  
+  auto shard_itr = shardsTable.find(account.value);
+  if (registered && shard_itr == shardsTable.end()) {
+    check(bankroll_stats_t(account, account.value).exists(),
+    "the bankroll contract of the shard is not initialized");
+    shardsTable.emplace(_self, [&](auto& s) {
+      s.account = account;
+    });
+  } else if (!registered && shard_itr != shardsTable.end()) {
+    //Rolls that were already sent to the shard still accept its results
+    shardsTable.erase(shard_itr);
+  }
+}
+
+
+
+
+/**
+ * Read only action that returns the largest quantity that can currently be bet on an existing roll
+ * This is meant to be called by frontends without broadcasting the transaction, in order to show the max bet
+ * 
+ * @param roll_id - The id of the roll to bet on
+ * @param lower_bound - The lower bound of the range to bet on
+ * @param upper_bound - The upper bound of the range to bet on
+ * @param multiplier - The multiplier of the bet x1000 (multiplier 2000 => 2x payout)
+ * @return - The max quantity of WAX that would be accepted with the current bankroll. 0 if no bet would be accepted
+ */
+[[eosio::action]] asset pinkgambling::maxbet(uint64_t roll_id, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier) {
+  auto roll_itr = rollsTable.find(roll_id);
+  check(roll_itr != rollsTable.end(),
+  "no roll with this id exist");
+  check(!roll_itr->waiting_for_result,
+  "cant join while the roll is waiting for a result");
+  
+  checkBetParameters(roll_itr->max_result, lower_bound, upper_bound, multiplier);
+  
+  if (roll_itr->bet_count > 0xFFFF) {
+    return asset(0, CORE_SYMBOL);
   }
+  
+  ChainedRange firstRange = ChainedRange(1, roll_itr->max_result, 0);
+  uint64_t total_bets_collected = insertRollBets(roll_id, firstRange);
+  uint64_t min_amount = getMinBetAmount(roll_itr->cycle_number, roll_itr->bet_count);
+  return getMaxBetQuantity(firstRange, total_bets_collected, lower_bound, upper_bound, multiplier, min_amount);
+}
+
+
+
+
+/**
+ * Read only action that returns the largest quantity that can currently be bet with a quick bet (#bet memo)
+ * This is meant to be called by frontends without broadcasting the transaction, in order to show the max bet
+ * 
+ * @param lower_bound - The lower bound of the range to bet on
+ * @param upper_bound - The upper bound of the range to bet on
+ * @param multiplier - The multiplier of the bet x1000 (multiplier 2000 => 2x payout)
+ * @return - The max quantity of WAX that would be accepted with the current bankroll. 0 if no bet would be accepted
+ */
+[[eosio::action]] asset pinkgambling::maxquickbet(uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier) {
+  checkBetParameters(QUICK_BET_MAX_RESULT, lower_bound, upper_bound, multiplier);
+  
+  ChainedRange firstRange = ChainedRange(1, QUICK_BET_MAX_RESULT, 0);
+  return getMaxBetQuantity(firstRange, 0, lower_bound, upper_bound, multiplier, getMinBetAmount(0, 0));
+}
+
+
+
+
+/**
+ * Read only action that returns the liability profile of a roll: the total payout of its bets for every possible result
+ * The results are compressed to ranges with the same payout, so the profile has at most 2 * bet_count + 1 ranges.
+ * The bankroll loses payout - collected_sum of the roll if a result within a range is rolled
+ * This is meant to be polled by dashboards without broadcasting the transaction
+ * 
+ * @param roll_id - The id of the roll
+ * @return - The ranges in ascending order, covering all results from 1 to the max result of the roll
+ */
+[[eosio::action]] std::vector<pinkgambling::liabilityRange> pinkgambling::getliability(uint64_t roll_id) {
+  auto roll_itr = rollsTable.find(roll_id);
+  check(roll_itr != rollsTable.end(),
+  "no roll with this id exist");
+  
+  ExposureIndex index = getExposureIndex(roll_id, roll_itr->max_result);
+  
+  std::vector<liabilityRange> liability;
+  index.forEachRange([&](uint32_t range_index, uint64_t payout) {
+    //Neighbouring ranges of the index can have the same payout, e.g. if one bet ends where another one with the same payout starts
+    if (!liability.empty() && liability.back().payout == payout) {
+      liability.back().upper_bound = index.getUpperBound(range_index);
+    } else {
+      liability.push_back(liabilityRange{index.getLowerBound(range_index), index.getUpperBound(range_index), payout});
+    }
+  });
+  return liability;
 }
 
 
@@ -174,8 +489,40 @@ void pinkgambling::receivetransfer(name from, name to, asset quantity, std::stri
     uint32_t parsed_upper_bound = std::strtoull(substrings[3].c_str(), 0, 10);
     uint64_t parsed_random_seed = std::strtoull(substrings[4].c_str(), 0, 16);
     
+    //Open batch rolls are also waiting for bets, but can only be joined with quick bets
+    auto roll_itr = rollsTable.find(parsed_roll_id);
+    check(roll_itr == rollsTable.end() || roll_itr->cycle_number != 0,
+    "only cycles can be joined");
+    
     addBet(quantity, parsed_roll_id, from, parsed_multiplier, parsed_lower_bound, parsed_upper_bound, parsed_random_seed);
     
+    
+  } else if (memo.find("#play ") == 0) {
+    std::string substrings[5];
+    int64_t last_whitespace = memo.find(" ");
+    
+    for (int i = 0; i < 4; i++) {
+      int64_t next_whitespace = memo.find(" ", last_whitespace + 1);
+      check(next_whitespace != std::string::npos,
+      "memo has an invalid input format");
+      substrings[i] = memo.substr(last_whitespace + 1, next_whitespace - last_whitespace - 1);
+      last_whitespace = next_whitespace;
+    }
+    substrings[4] = memo.substr(last_whitespace + 1);
+    
+    uint32_t parsed_game_id = std::strtoull(substrings[0].c_str(), 0, 10);
+    uint32_t parsed_bet_type_id = std::strtoull(substrings[1].c_str(), 0, 10);
+    name parsed_rake_recipient = name(substrings[2]);
+    uint64_t parsed_identifier = std::strtoull(substrings[3].c_str(), 0, 16);
+    uint64_t parsed_random_seed = std::strtoull(substrings[4].c_str(), 0, 16);
+    
+    playGame(quantity, from, parsed_game_id, parsed_bet_type_id, parsed_rake_recipient, parsed_identifier, parsed_random_seed);
+    
+  } else if (memo.compare("bet payout") == 0) {
+    //The amount paid for a rejected roll, claimed by receivenotifyreject. It has already been credited to the refunds of the bettors
+    check(from == "roll.pink"_n || shardsTable.find(from.value) != shardsTable.end(),
+    "only bankroll shards can send bet payouts to this contract");
+    
   } else {
     check(false, "invalid memo");
   }
@@ -186,6 +533,7 @@ void pinkgambling::receivetransfer(name from, name to, asset quantity, std::stri
 
 /**
  * This is called by the bankroll contract when there is a result for one of the submitted rolls available
+ * Since there can be multiple bankroll shards, the result is only accepted from the shard that the roll was sent to
  * 
  * @param creator - The creator of the roll, should always be this contract
  * @param creator_id - The creator id submitted when sending the roll data to the bankroll contract. Equal to the roll_id
@@ -195,12 +543,70 @@ void pinkgambling::receivenotifyresult(name creator, uint64_t creator_id, uint32
   check(creator == _self,
   "this result is not meant for this account");
   
+  auto roll_itr = rollsTable.find(creator_id);
+  check(roll_itr != rollsTable.end() && roll_itr->shard == get_first_receiver(),
+  "the result has to come from the bankroll shard that the roll was sent to");
+  
   handleResult(creator_id, result);
 }
 
 
 
 
+/**
+ * This is called by the bankroll contract when it rejects a roll with external bets instead of providing a result,
+ * because the bets in this contract don't match the ones the roll was started with anymore
+ * The whole bets are credited to the refunds of their bettors, and the amount that was paid for the roll is claimed back from the bankroll.
+ * A cycle is reopened for new bets in the same cycle, every other roll is erased
+ * 
+ * @param creator - The creator of the roll, should always be this contract
+ * @param creator_id - The creator id submitted when sending the roll data to the bankroll contract. Equal to the roll_id
+ * @param refund - The amount paid for the roll, which has been credited to the payouts of this contract in the bankroll contract
+ */
+void pinkgambling::receivenotifyreject(name creator, uint64_t creator_id, asset refund) {
+  check(creator == _self,
+  "this rejection is not meant for this account");
+  
+  auto roll_itr = rollsTable.find(creator_id);
+  check(roll_itr != rollsTable.end() && roll_itr->shard == get_first_receiver(),
+  "the rejection has to come from the bankroll shard that the roll was sent to");
+  check(roll_itr->waiting_for_result,
+  "the roll isn't waiting for a result");
+  
+  refundRollBets(creator_id);
+  
+  action(
+    permission_level{_self, "active"_n},
+    _self,
+    "logreduction"_n,
+    std::make_tuple(creator_id, roll_itr->cycle_number, 1.0)
+  ).send();
+  
+  if (roll_itr->cycle_number == 0) {
+    rollsTable.erase(roll_itr);
+  } else {
+    rollsTable.modify(roll_itr, _self, [&](auto& r) {
+      r.waiting_for_result = false;
+      r.bet_scale = BET_SCALE_PRECISION;
+      r.bet_count = 0;
+      r.payout_sum = 0;
+      r.collected_sum = 0;
+    });
+  }
+  
+  if (refund.amount > 0) {
+    action(
+      permission_level{_self, "active"_n},
+      get_first_receiver(),
+      "payoutbet"_n,
+      std::make_tuple(_self, refund)
+    ).send();
+  }
+}
+
+
+
+
 /**
  * Private function to create a new cycle that has already been paid for
  * 
@@ -211,6 +617,8 @@ void pinkgambling::receivenotifyresult(name creator, uint64_t creator_id, uint32
 void pinkgambling::createCycle(uint32_t max_result, name rake_recipient, uint32_t cycle_time) {
   check(cycle_time >= 10,
   "the cycle time must be at last 10 seconds");
+  check(max_result != 0 && max_result <= MAX_PACKED_BOUND,
+  "the max result must be between 1 and 1048575");
   //available_primary_key can't be used, because finished rolls are deleted from the table
   statsStruct stats = statsTable.get();
   uint64_t roll_id = stats.current_roll_id++;
@@ -226,6 +634,10 @@ void pinkgambling::createCycle(uint32_t max_result, name rake_recipient, uint32_
     r.last_cycle = current_time_point();
     r.last_player_joined = current_time_point();
     r.cycle_time = cycle_time;
+    r.bet_scale = BET_SCALE_PRECISION;
+    r.bet_count = 0;
+    r.payout_sum = 0;
+    r.collected_sum = 0;
   });
   
   action(
@@ -241,6 +653,7 @@ void pinkgambling::createCycle(uint32_t max_result, name rake_recipient, uint32_
 
 /**
  * Private function to create and send a bet within a single transaction. max_result is always 10000
+ * If batching is enabled, the bet is added to a shared batch roll instead, see batchQuickBet
  * 
  * @param quantity - The amount of WAX to be bet
  * @param bettor - The account name of the bettor
@@ -252,98 +665,239 @@ void pinkgambling::createCycle(uint32_t max_result, name rake_recipient, uint32_
  * @param client_seed - A seed that will be used in the bankroll contract. Should be random to avoid possible collisions in the RNG oracle
  */
 void pinkgambling::quickBet(asset quantity, name bettor, uint32_t multiplier, uint32_t lower_bound, uint32_t upper_bound, name rake_recipient, uint64_t identifier, uint64_t random_seed)  {
-  //available_primary_key can't be used, because finished rolls are deleted from the table
-  statsStruct stats = statsTable.get();
-  uint64_t roll_id = stats.current_roll_id++;
-  statsTable.set(stats, _self);
-  
-  rollsTable.emplace(_self, [&](rollStruct &r) {
-    r.roll_id = roll_id;
-    r.max_result = 10000;
-    r.rake_recipient = rake_recipient;
-    r.waiting_for_result = false;
-    r.identifier = identifier;
-    r.cycle_number = 0;
-    r.last_cycle = eosio::time_point(microseconds(0));
-    r.last_player_joined = eosio::time_point(microseconds(0));
-    r.cycle_time = 0;
-  });
+  if (batchConfigTable.get_or_default().enabled) {
+    batchQuickBet(quantity, bettor, multiplier, lower_bound, upper_bound, rake_recipient, identifier, random_seed);
+    return;
+  }
   
+  uint64_t roll_id = createQuickRoll(rake_recipient, identifier, QUICK_BET_MAX_RESULT);
   addBet(quantity, roll_id, bettor, multiplier, lower_bound, upper_bound, random_seed);
-  sendRoll(roll_id);
+  sendRoll(roll_id, BET_SCALE_PRECISION, getSingleBetRequiredBankroll(quantity.amount, lower_bound, upper_bound, multiplier, QUICK_BET_MAX_RESULT));
 }
 
 
 
 
 /**
- * Private function to add bets to a roll.
- * Checks for validity of the inputs, as well as checking if the bet is acceptable
- * for the bankroll contract.
+ * Private function to create and send a bet of one of the bet types of a game (see games.hpp) within a single transaction
+ * The bet type has already been checked at compile time and its EV and risk are precomputed,
+ * so the bet only needs a lookup instead of checkBetParameters, and the bankroll check takes constant time
  * 
  * @param quantity - The amount of WAX to be bet
  * @param bettor - The account name of the bettor
- * @param multiplier - The multiplier of the bet x1000 (multiplier 2000 => 2x payout)
- * @param lower_bound - The lower bound of the range to bet on
- * @param upper_bound - The upper bound of the range to bet on
+ * @param game_id - The id of the game to play
+ * @param bet_type_id - The id of the bet type within the game
+ * @param rake_recipient - The account name to receive the rake for this bet
+ * @param identifier - An identifier used for tracking this bet, but generally not used for the smart contact logic
+ * @param random_seed - A seed that will be used in the bankroll contract. Should be random to avoid possible collisions in the RNG oracle
  */
-void pinkgambling::addBet(asset quantity, uint64_t roll_id, name bettor, uint32_t multiplier, uint32_t lower_bound, uint32_t upper_bound, uint64_t random_seed) {
-  auto roll_itr = rollsTable.find(roll_id);
-  check(roll_itr != rollsTable.end(),
-  "no roll with this id exist");
-  check(!roll_itr->waiting_for_result,
-  "cant join while the roll is waiting for a result");
-  rollsTable.modify(roll_itr, _self, [&](auto& r) {
-    r.last_player_joined = current_time_point();
-  });
-  
+void pinkgambling::playGame(asset quantity, name bettor, uint32_t game_id, uint32_t bet_type_id, name rake_recipient, uint64_t identifier, uint64_t random_seed) {
+  const GameBetType* bet_type = getGameBetType(game_id, bet_type_id);
+  check(bet_type != nullptr,
+  "there is no bet type with this id in this game");
   
-  check(lower_bound >= 1,
-  "lower_bound needs to be at least 1");
-  check(lower_bound <= upper_bound,
-  "lower_bound can't be greater than upper_bound");
-  check(upper_bound <= roll_itr->max_result,
-  "upper_bound can't be greater than the max_result of the roll");
+  uint64_t roll_id = createQuickRoll(rake_recipient, identifier, bet_type->max_result);
+  storeBet(rollsTable.find(roll_id), quantity, bettor, bet_type->multiplier, bet_type->lower_bound, bet_type->upper_bound, random_seed, bet_type->getCollectedAmount(quantity.amount));
   
-  check(multiplier > 1000,
-  "the multiplier has to be greater than 1000 (greater than 1x)");
+  //The roll only has this bet, see addBet
+  asset required_bankroll = asset((int64_t)bet_type->getRequiredBankroll(quantity.amount), CORE_SYMBOL);
+  check(getBankroll().amount * 0.95 >= required_bankroll.amount,
+  "the current bankroll is too small to accept this bet");
   
-  double odds = (double)(upper_bound - lower_bound + 1) / (double)roll_itr->max_result;
-  check (odds >= 0.005,
-  "the odds cant be smaller than 0.005");
-  double ev = odds * multiplier / 1000.0;
-  check(ev <= 0.99,
-  "the bet cant have an EV greater than 0.99 * quantity");
+  sendRoll(roll_id, BET_SCALE_PRECISION, required_bankroll);
+}
+
+
+
+
+/**
+ * Private function to add a quick bet to the open batch roll of its rake recipient
+ * A new batch is opened if there is none, or if the bet doesn't fit into the bankroll together with the bets of the open batch.
+ * In that case, the open batch is sent first, so that every bet that would be accepted as a single quick bet is also accepted here.
+ * The batch is sent as soon as it has max_bets bets, or with the first bet after its window has passed
+ * 
+ * For the parameters, see quickBet
+ */
+void pinkgambling::batchQuickBet(asset quantity, name bettor, uint32_t multiplier, uint32_t lower_bound, uint32_t upper_bound, name rake_recipient, uint64_t identifier, uint64_t random_seed) {
+  batchConfigStruct config = batchConfigTable.get_or_default();
   
-  rollBets_t betsTable(_self, roll_id);
-  uint64_t bet_id = betsTable.available_primary_key();
-  if (bet_id >= 10) {
-    check(quantity.amount >= 100000000,
-    "The 10th bet and higher need to be at least 1 WAX as a spam protection");
-  };
-  if (bet_id >= 100) {
-    check(quantity.amount >= 1000000000,
-    "The 100th bet and higher need to be at least 10 WAX as a spam protection");
+  auto batch_itr = batchesTable.find(rake_recipient.value);
+  if (batch_itr != batchesTable.end() && !fitsIntoRoll(batch_itr->roll_id, quantity, lower_bound, upper_bound, multiplier)) {
+    flushBatch(rake_recipient);
+    batch_itr = batchesTable.end();
   }
-  betsTable.emplace(_self, [&](betStruct &b) {
-    b.bet_id = bet_id;
-    b.bettor = bettor;
-    b.quantity = quantity;
-    b.lower_bound = lower_bound;
-    b.upper_bound = upper_bound;
-    b.multiplier = multiplier;
-    b.random_seed = random_seed;
+  
+  if (batch_itr == batchesTable.end()) {
+    uint64_t new_roll_id = createQuickRoll(rake_recipient, 0, QUICK_BET_MAX_RESULT);
+    batch_itr = batchesTable.emplace(_self, [&](batchStruct &b) {
+      b.rake_recipient = rake_recipient;
+      b.roll_id = new_roll_id;
+      b.opened = current_time_point();
+    });
+  }
+  
+  uint64_t roll_id = batch_itr->roll_id;
+  uint64_t bet_id = rollsTable.get(roll_id).bet_count;
+  addBet(quantity, roll_id, bettor, multiplier, lower_bound, upper_bound, random_seed);
+  
+  //The identifier of the roll is only used for single bets, so the identifiers of batched bets are logged separately
+  action(
+    permission_level{_self, "active"_n},
+    _self,
+    "logbatchbet"_n,
+    std::make_tuple(roll_id, bet_id, identifier)
+  ).send();
+  
+  if (bet_id + 1 >= config.max_bets || batch_itr->opened + microseconds((int64_t)config.window_ms * 1000) <= current_time_point()) {
+    flushBatch(rake_recipient);
+  }
+}
+
+
+
+
+/**
+ * Private function to create a roll for quick bets and games
+ * 
+ * @param rake_recipient - The account name to receive the rake for this roll
+ * @param identifier - The identifier of the quick bet, or 0 for batch rolls
+ * @param max_result - The max result of the roll. Always 10000 for quick bets
+ * @return - The id of the new roll
+ */
+uint64_t pinkgambling::createQuickRoll(name rake_recipient, uint64_t identifier, uint32_t max_result) {
+  //available_primary_key can't be used, because finished rolls are deleted from the table
+  statsStruct stats = statsTable.get();
+  uint64_t roll_id = stats.current_roll_id++;
+  statsTable.set(stats, _self);
+  
+  rollsTable.emplace(_self, [&](rollStruct &r) {
+    r.roll_id = roll_id;
+    r.max_result = max_result;
+    r.rake_recipient = rake_recipient;
+    r.waiting_for_result = false;
+    r.identifier = identifier;
+    r.cycle_number = 0;
+    r.last_cycle = eosio::time_point(microseconds(0));
+    r.last_player_joined = eosio::time_point(microseconds(0));
+    r.cycle_time = 0;
+    r.bet_scale = BET_SCALE_PRECISION;
+    r.bet_count = 0;
+    r.payout_sum = 0;
+    r.collected_sum = 0;
   });
   
-  asset required_bankroll = calculateRollRequiredBankroll(roll_id);
-  bankroll_stats_t bankrollStatsTable("roll.pink"_n, "roll.pink"_n.value);
-  bankrollStatsStruct bankroll_stats = bankrollStatsTable.get();
+  return roll_id;
+}
+
+
+
+
+/**
+ * Private function to close the open batch of a rake recipient and send its roll to the bankroll contract
+ * If the bankroll can't accept any part of the bets anymore, they are credited to the refunds of their bettors instead,
+ * so that the batch neither fails the bet that caused the flush nor blocks later bets of the rake recipient
+ * 
+ * @param rake_recipient - The rake recipient of the batch
+ */
+void pinkgambling::flushBatch(name rake_recipient) {
+  auto batch_itr = batchesTable.find(rake_recipient.value);
+  check(batch_itr != batchesTable.end(),
+  "there is no open batch for this rake recipient");
+  
+  uint64_t roll_id = batch_itr->roll_id;
+  batchesTable.erase(batch_itr);
+  
+  //The bankroll might have shrunk since the bets were added
+  if (!sendRollWithinBankroll(roll_id)) {
+    refundRollBets(roll_id);
+    rollsTable.erase(rollsTable.find(roll_id));
+    
+    action(
+      permission_level{_self, "active"_n},
+      _self,
+      "logreduction"_n,
+      std::make_tuple(roll_id, (uint64_t)0, 1.0)
+    ).send();
+  }
+}
+
+
+
+
+/**
+ * Private function to add bets to a roll.
+ * Checks for validity of the inputs, as well as checking if the bet is acceptable
+ * for the bankroll contract.
+ * 
+ * @param quantity - The amount of WAX to be bet
+ * @param bettor - The account name of the bettor
+ * @param multiplier - The multiplier of the bet x1000 (multiplier 2000 => 2x payout)
+ * @param lower_bound - The lower bound of the range to bet on
+ * @param upper_bound - The upper bound of the range to bet on
+ */
+void pinkgambling::addBet(asset quantity, uint64_t roll_id, name bettor, uint32_t multiplier, uint32_t lower_bound, uint32_t upper_bound, uint64_t random_seed) {
+  auto roll_itr = rollsTable.find(roll_id);
+  check(roll_itr != rollsTable.end(),
+  "no roll with this id exist");
+  check(!roll_itr->waiting_for_result,
+  "cant join while the roll is waiting for a result");
+  checkBetParameters(roll_itr->max_result, lower_bound, upper_bound, multiplier);
+  
+  uint64_t collected = getCollectedAmount(quantity.amount, lower_bound, upper_bound, multiplier, roll_itr->max_result);
+  uint64_t bet_id = storeBet(roll_itr, quantity, bettor, multiplier, lower_bound, upper_bound, random_seed, collected);
   
   // The maxbet for the gambling contract is 95% of the maxbet of the bankroll contract
   // This is to make a sitation in which the bankroll would shrink so low that the original bet wouldn't be accepted anymore
   // less likely and harder to provoke
-  check(bankroll_stats.bankroll.amount * 0.95 >= required_bankroll.amount,
-  "the current bankroll is too small to accept this bet");
+  double usable_bankroll = getBankroll().amount * 0.95;
+  
+  //Rolls that only require a small part of the bankroll already fit with the upper limit from the running sums of the roll
+  //Rolls that require more of it are checked exactly, see tools/README.md for how often this is the case. The first bet
+  //of a roll (always the case for quick bets) can be checked exactly in constant time as well, without reading the bets table
+  double variance_bound = getVarianceBound(roll_itr->payout_sum, roll_itr->collected_sum, roll_itr->bet_count, roll_itr->max_result);
+  if (getRequiredBankrollBound(variance_bound) > usable_bankroll) {
+    asset required_bankroll = bet_id == 0
+      ? getSingleBetRequiredBankroll(quantity.amount, lower_bound, upper_bound, multiplier, roll_itr->max_result)
+      : calculateRollRequiredBankroll(roll_id);
+    check(usable_bankroll >= required_bankroll.amount,
+    "the current bankroll is too small to accept this bet");
+  }
+}
+
+
+
+
+/**
+ * Private function to store a bet that has already been checked, and to add it to the running sums of its roll
+ * 
+ * @param roll_itr - The roll to add the bet to
+ * @param collected - The amount collected from the bet, see getCollectedAmount
+ * @return - The id of the bet within the roll
+ */
+uint64_t pinkgambling::storeBet(rolls_t::const_iterator roll_itr, asset quantity, name bettor, uint32_t multiplier, uint32_t lower_bound, uint32_t upper_bound, uint64_t random_seed, uint64_t collected) {
+  uint64_t roll_id = roll_itr->roll_id;
+  uint64_t bet_id = roll_itr->bet_count;
+  check(bet_id <= 0xFFFF,
+  "a roll can't have more than 65536 bets");
+  check(quantity.amount >= getMinBetAmount(roll_itr->cycle_number, bet_id),
+  bet_id >= 100
+    ? "The 100th bet and higher need to be at least 10 WAX as a spam protection"
+    : "The 10th bet and higher need to be at least 1 WAX as a spam protection");
+  
+  rollsTable.modify(roll_itr, _self, [&](auto& r) {
+    r.last_player_joined = current_time_point();
+    r.bet_count += 1;
+    r.payout_sum += quantity.amount * multiplier / 1000;
+    r.collected_sum += collected;
+  });
+  
+  betsTable.emplace(_self, [&](betStruct &b) {
+    b.bet_key = getBetKey(roll_id, bet_id);
+    b.bettor = bettor;
+    b.amount = quantity.amount;
+    b.packed_bet = packBet(lower_bound, upper_bound, multiplier);
+    b.random_seed = random_seed;
+  });
   
   action(
     permission_level{_self, "active"_n},
@@ -351,6 +905,88 @@ void pinkgambling::addBet(asset quantity, uint64_t roll_id, name bettor, uint32_
     "logbet"_n,
     std::make_tuple(roll_id, roll_itr->cycle_number, bet_id, bettor, quantity, lower_bound, upper_bound, multiplier, random_seed)
   ).send();
+  
+  return bet_id;
+}
+
+
+
+
+/**
+ * Private function to check if the parameters of a bet are valid
+ * 
+ * @param max_result - The max result of the roll to bet on
+ * @param lower_bound - The lower bound of the range to bet on
+ * @param upper_bound - The upper bound of the range to bet on
+ * @param multiplier - The multiplier of the bet x1000 (multiplier 2000 => 2x payout)
+ */
+void pinkgambling::checkBetParameters(uint32_t max_result, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier) {
+  check(lower_bound >= 1,
+  "lower_bound needs to be at least 1");
+  check(lower_bound <= upper_bound,
+  "lower_bound can't be greater than upper_bound");
+  check(upper_bound <= max_result,
+  "upper_bound can't be greater than the max_result of the roll");
+  
+  check(multiplier > 1000,
+  "the multiplier has to be greater than 1000 (greater than 1x)");
+  
+  double odds = (double)(upper_bound - lower_bound + 1) / (double)max_result;
+  check (odds >= 0.005,
+  "the odds cant be smaller than 0.005");
+  double ev = odds * multiplier / 1000.0;
+  check(ev <= 0.99,
+  "the bet cant have an EV greater than 0.99 * quantity");
+}
+
+
+
+
+/**
+ * Private function to send a roll with bets to the bankroll contract, after making sure that the bankroll can accept it
+ * 
+ * Checks if the roll is within the bankroll contract's bankroll management, using the same limit as addBet (95% of the bankroll contract's limit)
+ * If not, all bets get reduced by the largest factor with which the whole roll will be acceptable again
+ * The factor is only stored on the roll and applied when sending the bets. The part of each bet that
+ * isn't bet is credited to the bettor's refunds when the result is received and can be claimed with claimrefund
+ * 
+ * @param roll_id - The id of the roll to send
+ * @return - false if the bets would have to be reduced to nothing. The roll is not sent then
+ */
+bool pinkgambling::sendRollWithinBankroll(uint64_t roll_id) {
+  auto roll_itr = rollsTable.find(roll_id);
+  
+  ChainedRange firstRange = ChainedRange(1, roll_itr->max_result, 0);
+  uint64_t total_bets_collected = insertRollBets(roll_id, firstRange);
+  asset required_bankroll = getRequiredBankroll(firstRange, total_bets_collected, roll_itr->max_result);
+  //The remaining 5% absorb the differences to the variance that the bankroll contract calculates, see addBet
+  asset usable_bankroll = asset((int64_t)(getBankroll().amount * 0.95), CORE_SYMBOL);
+  
+  uint32_t bet_scale = BET_SCALE_PRECISION;
+  if (usable_bankroll < required_bankroll) {
+    double scale = getMaxScaleFactor(firstRange, total_bets_collected, roll_itr->max_result, required_bankroll, usable_bankroll);
+    bet_scale = (uint32_t)(scale * BET_SCALE_PRECISION);
+    required_bankroll = getScaledRequiredBankroll(firstRange, total_bets_collected, roll_itr->max_result, (double)bet_scale / BET_SCALE_PRECISION);
+    
+    //The transfer that starts the roll can't be sent without an amount
+    int64_t scaled_total = 0;
+    for (auto bet_itr = betsTable.lower_bound(getBetKey(roll_id, 0)); bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id; bet_itr++) {
+      scaled_total += getScaledQuantity(bet_itr->get_quantity(), bet_scale).amount;
+    }
+    if (scaled_total == 0) {
+      return false;
+    }
+    
+    action(
+      permission_level{_self, "active"_n},
+      _self,
+      "logreduction"_n,
+      std::make_tuple(roll_id, roll_itr->cycle_number, 1.0 - scale)
+    ).send();
+  }
+  
+  sendRoll(roll_id, bet_scale, required_bankroll);
+  return true;
 }
 
 
@@ -360,9 +996,15 @@ void pinkgambling::addBet(asset quantity, uint64_t roll_id, name bettor, uint32_
  * Private function that first transmits all the required data of a roll to the bankroll cotnract
  * and then sends the WAX to start the roll
  * 
+ * If this contract is registered to use external bets in the bankroll contract and the bets are not reduced,
+ * the bets are not announced. The bankroll contract reads them directly from the bets table of this contract instead.
+ * The bets of the roll are not changed until the result is received, see handleResult
+ * 
  * @param roll_id - The id of the roll to send
+ * @param bet_scale - The part of each bet that is actually bet, x BET_SCALE_PRECISION
+ * @param required_bankroll - The bankroll that the sent bets require, see reserveBankroll
  */
-void pinkgambling::sendRoll(uint64_t roll_id) {
+void pinkgambling::sendRoll(uint64_t roll_id, uint32_t bet_scale, asset required_bankroll) {
   auto roll_itr = rollsTable.find(roll_id);
   check(roll_itr != rollsTable.end(),
   "the roll id doesn't exist");
@@ -370,27 +1012,42 @@ void pinkgambling::sendRoll(uint64_t roll_id) {
   check(!roll_itr->waiting_for_result,
   "the roll has already been sent to the bankroll cotnract");
   
+  //The bankroll checks of the bets were made against the same shard, see getBankroll
+  name shard = getShard();
+  check(shard != name(),
+  "no bankroll shard is currently accepting rolls");
+  reserveBankroll(required_bankroll);
+  
   rollsTable.modify(roll_itr, _self, [&](auto& r) {
     r.waiting_for_result = true;
+    r.bet_scale = bet_scale;
+    r.shard = shard;
   });
   
   
+  bankroll_ext_creators_t bankrollExtCreatorsTable(shard, shard.value);
+  bool external_bets = bet_scale == BET_SCALE_PRECISION
+    && bankrollExtCreatorsTable.find(_self.value) != bankrollExtCreatorsTable.end();
+  
   action(
     permission_level{_self, "active"_n},
-    "roll.pink"_n,
-    "announceroll"_n,
+    shard,
+    external_bets ? "announceext"_n : "announceroll"_n,
     std::make_tuple(_self, roll_id, roll_itr->max_result, roll_itr->rake_recipient)
   ).send();
   
   asset total_bet = asset(0, CORE_SYMBOL);
-  rollBets_t betsTable(_self, roll_id);
-  for (auto bet_itr = betsTable.begin(); bet_itr != betsTable.end(); bet_itr++) {
-    total_bet += bet_itr->quantity;
+  for (auto bet_itr = betsTable.lower_bound(getBetKey(roll_id, 0)); bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id; bet_itr++) {
+    asset scaled_quantity = getScaledQuantity(bet_itr->get_quantity(), bet_scale);
+    total_bet += scaled_quantity;
+    if (external_bets) {
+      continue;
+    }
     action(
     permission_level{_self, "active"_n},
-      "roll.pink"_n,
+      shard,
       "announcebet"_n,
-      std::make_tuple(_self, roll_id, bet_itr->bettor, bet_itr->quantity, bet_itr->lower_bound, bet_itr->upper_bound, bet_itr->multiplier, bet_itr->random_seed)
+      std::make_tuple(_self, roll_id, bet_itr->bettor, scaled_quantity, bet_itr->get_lower_bound(), bet_itr->get_upper_bound(), bet_itr->get_multiplier(), bet_itr->random_seed)
     ).send();
   }
   
@@ -398,7 +1055,7 @@ void pinkgambling::sendRoll(uint64_t roll_id) {
     permission_level{_self, "active"_n},
     "eosio.token"_n,
     "transfer"_n,
-    std::make_tuple(_self, "roll.pink"_n, total_bet, std::string("startroll ") + std::to_string(roll_id))
+    std::make_tuple(_self, shard, total_bet, std::string("startroll ") + std::to_string(roll_id))
   ).send();
   
 }
@@ -428,14 +1085,16 @@ void pinkgambling::handleResult(uint64_t roll_id, uint32_t result) {
     std::make_tuple(roll_id, roll_itr->cycle_number, roll_itr->max_result, roll_itr->rake_recipient, result, roll_itr->identifier, roll_itr->cycle_time)
   ).send();
   
-  //Removing all bet table entries
-  rollBets_t betsTable(_self, roll_id);
-  auto bet_itr = betsTable.begin();
-  while(bet_itr != betsTable.end()) {
-    //erase returns iterator poiting to next entry
-    bet_itr = betsTable.erase(bet_itr);
+  //If the bets were reduced, the part that wasn't bet is credited to the bettors
+  if (roll_itr->bet_scale != BET_SCALE_PRECISION) {
+    for (auto bet_itr = betsTable.lower_bound(getBetKey(roll_id, 0)); bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id; bet_itr++) {
+      creditRefund(bet_itr->bettor, bet_itr->get_quantity() - getScaledQuantity(bet_itr->get_quantity(), roll_itr->bet_scale));
+    }
   }
   
+  //Removing all bet table entries
+  eraseRollBets(roll_id);
+  
   if (roll_itr->cycle_number == 0) {
     //Non-cycle roll
     rollsTable.erase(roll_itr);
@@ -445,14 +1104,259 @@ void pinkgambling::handleResult(uint64_t roll_id, uint32_t result) {
     rollsTable.modify(roll_itr, _self, [&](auto& r) {
       r.cycle_number += 1;
       r.waiting_for_result = false;
+      r.bet_scale = BET_SCALE_PRECISION;
+      r.bet_count = 0;
+      r.payout_sum = 0;
+      r.collected_sum = 0;
       r.last_cycle = current_time_point();
     });
   }
 }
 
 
+
+
+/**
+ * Private function to credit WAX that was not bet to the refunds of a bettor
+ * 
+ * @param bettor - The account name of the bettor
+ * @param quantity - The amount of WAX to credit
+ */
+void pinkgambling::creditRefund(name bettor, asset quantity) {
+  if (quantity.amount == 0) {
+    return;
+  }
+  auto refund_itr = refundsTable.find(bettor.value);
+  if (refund_itr != refundsTable.end()) {
+    refundsTable.modify(refund_itr, _self, [&](auto& r) {
+      r.balance += quantity;
+    });
+  } else {
+    refundsTable.emplace(_self, [&](auto& r) {
+      r.bettor = bettor;
+      r.balance = quantity;
+    });
+  }
+}
+
+
+
+
+/**
+ * Private function to erase all bets of a roll
+ * Because of the bet keys, the bets of a roll are one consecutive range of the bets table
+ * 
+ * @param roll_id - The id of the roll to erase the bets of
+ */
+void pinkgambling::eraseRollBets(uint64_t roll_id) {
+  auto bet_itr = betsTable.lower_bound(getBetKey(roll_id, 0));
+  while (bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id) {
+    //erase returns iterator poiting to next entry
+    bet_itr = betsTable.erase(bet_itr);
+  }
+}
+
+
+
+
+/**
+ * Private function to credit the full quantity of every bet of a roll to the refunds of its bettor and erase the bets
+ * Used for bets that can't be played, see flushBatch and receivenotifyreject
+ * 
+ * @param roll_id - The id of the roll to refund the bets of
+ */
+void pinkgambling::refundRollBets(uint64_t roll_id) {
+  for (auto bet_itr = betsTable.lower_bound(getBetKey(roll_id, 0)); bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id; bet_itr++) {
+    creditRefund(bet_itr->bettor, bet_itr->get_quantity());
+  }
+  eraseRollBets(roll_id);
+}
+
+
+
+
+/**
+ * Returns the part of a bet quantity that is actually bet when the bets of a roll are reduced
+ * 
+ * @param quantity - The quantity of the bet
+ * @param bet_scale - The part of each bet that is actually bet, x BET_SCALE_PRECISION
+ */
+asset pinkgambling::getScaledQuantity(asset quantity, uint32_t bet_scale) {
+  return asset((int64_t)((int128_t)quantity.amount * bet_scale / BET_SCALE_PRECISION), quantity.symbol);
+}
+
+
+/**
+ * Returns the primary key of a bet in the bets table
+ * 
+ * @param roll_id - The id of the roll the bet belongs to
+ * @param bet_id - The id of the bet within the roll (< 65536)
+ */
+uint64_t pinkgambling::getBetKey(uint64_t roll_id, uint64_t bet_id) {
+  return roll_id << 16 | bet_id;
+}
+
+
+/**
+ * Packs the bounds and the multiplier of a bet into a single value, see betStruct
+ * 
+ * @param lower_bound - The lower bound of the bet (< 2^20)
+ * @param upper_bound - The upper bound of the bet (< 2^20)
+ * @param multiplier - The multiplier of the bet x1000 (< 2^18)
+ */
+uint64_t pinkgambling::packBet(uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier) {
+  check(upper_bound <= MAX_PACKED_BOUND && multiplier <= MAX_PACKED_MULTIPLIER,
+  "the bet can't be packed");
+  return (uint64_t)multiplier | (uint64_t)lower_bound << 18 | (uint64_t)upper_bound << 38;
+}
+
+
+/**
+ * Returns the free bankroll of the shard that rolls are currently sent to, see getShard and getFreeBankroll
+ */
+asset pinkgambling::getBankroll() {
+  getShard();
+  return shardBankrollCache;
+}
+
+
+/**
+ * Returns the bankroll shard with the most free bankroll, which is the one that rolls are sent to.
+ * Without registered shards, this is always roll.pink
+ * If no shard currently accepts rolls, an empty name is returned and the bankroll is 0, so that no bets are accepted
+ * 
+ * The stats of the bankroll contracts are only read once per action and every later call uses the cached shard.
+ * The rolls sent by this action only change the stats in the inline actions that run after it, so every sent roll
+ * is taken out of the cached free bankroll instead, see reserveBankroll
+ */
+name pinkgambling::getShard() {
+  if (!shardLoaded) {
+    shardCache = name();
+    shardBankrollCache = asset(-1, CORE_SYMBOL);
+    if (shardsTable.begin() == shardsTable.end()) {
+      asset free_bankroll = getFreeBankroll("roll.pink"_n);
+      if (free_bankroll > shardBankrollCache) {
+        shardCache = "roll.pink"_n;
+        shardBankrollCache = free_bankroll;
+      }
+    } else {
+      for (auto shard_itr = shardsTable.begin(); shard_itr != shardsTable.end(); shard_itr++) {
+        asset free_bankroll = getFreeBankroll(shard_itr->account);
+        if (free_bankroll > shardBankrollCache) {
+          shardCache = shard_itr->account;
+          shardBankrollCache = free_bankroll;
+        }
+      }
+    }
+    if (shardCache == name()) {
+      shardBankrollCache = asset(0, CORE_SYMBOL);
+    }
+    shardLoaded = true;
+  }
+  return shardCache;
+}
+
+
+/**
+ * Returns the part of the bankroll of a bankroll contract that is not locked by the rolls that are waiting for their result
+ * The bankroll contract accepts a roll if its variance and the locked variance together fit into the bankroll.
+ * This is the same as the roll fitting into the returned bankroll on its own
+ * 
+ * @param shard - The account of the bankroll contract
+ * @return - -1 if the bankroll contract doesn't accept rolls, because it isn't initialized or is paused
+ */
+asset pinkgambling::getFreeBankroll(name shard) {
+  bankroll_stats_t bankrollStatsTable(shard, shard.value);
+  if (!bankrollStatsTable.exists()) {
+    return asset(-1, CORE_SYMBOL);
+  }
+  bankrollStatsStruct bankrollStats = bankrollStatsTable.get();
+  if (bankrollStats.paused) {
+    return asset(-1, CORE_SYMBOL);
+  }
+  double free_variance = pow(bankrollStats.bankroll.amount / 125.0, 3) - bankrollStats.locked_variance.value();
+  if (free_variance <= 0) {
+    return asset(0, CORE_SYMBOL);
+  }
+  return asset((int64_t)getRequiredBankrollFromVariance(free_variance), CORE_SYMBOL);
+}
+
+
+/**
+ * Takes the variance of a roll that is sent to the current shard out of its cached free bankroll, see getShard
+ * The bankroll contract locks the variance of the roll when it receives the transfer, which is only after this action.
+ * Without this, every roll sent by the same action would be checked against the same free bankroll
+ * 
+ * @param required_bankroll - The bankroll that the roll requires on its own
+ */
+void pinkgambling::reserveBankroll(asset required_bankroll) {
+  getShard();
+  double free_variance = pow(shardBankrollCache.amount / 125.0, 3) - pow(required_bankroll.amount / 125.0, 3);
+  if (free_variance <= 0) {
+    shardBankrollCache = asset(0, CORE_SYMBOL);
+  } else {
+    shardBankrollCache = asset((int64_t)getRequiredBankrollFromVariance(free_variance), CORE_SYMBOL);
+  }
+}
+
+
+/**
+ * Calculates the max quantity that can be bet on a roll, using the same limit as addBet (95% of the bankroll contract's limit)
+ * 
+ * @param firstRange - The first range of the roll, with all bets of the roll already inserted
+ * @param total_bets_collected - The total amount of the bets collected from the bets of the roll
+ * @param min_amount - The smallest amount the bet can have, see getMinBetAmount. 0 is returned if the max quantity is smaller
+ */
+asset pinkgambling::getMaxBetQuantity(ChainedRange& firstRange, uint64_t total_bets_collected, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint64_t min_amount) {
+  asset usable_bankroll = asset((int64_t)(getBankroll().amount * 0.95), CORE_SYMBOL);
+  
+  uint64_t max_amount = getMaxBetAmount(firstRange, total_bets_collected, firstRange.upperBound, lower_bound, upper_bound, multiplier, usable_bankroll);
+  if (max_amount < min_amount) {
+    return asset(0, CORE_SYMBOL);
+  }
+  return asset(max_amount, CORE_SYMBOL);
+}
+
+
+/**
+ * Returns the smallest amount that the next bet of a roll can have
+ * Cycles require larger bets once they already have many bets, as a spam protection
+ * Batch rolls are limited by the max bets of the batch config instead
+ * 
+ * @param bet_id - The id that the next bet would get, = bet_count of the roll
+ */
+uint64_t pinkgambling::getMinBetAmount(uint64_t cycle_number, uint64_t bet_id) {
+  if (cycle_number != 0 && bet_id >= 100) {
+    return 1000000000;
+  }
+  if (cycle_number != 0 && bet_id >= 10) {
+    return 100000000;
+  }
+  return 1;
+}
+
+
+/**
+ * Calculates the pseudo random result of a cycle in which no bets have been placed
+ * A simple integer hash (splitmix64) is used instead of sha256, so that skipping many idle cycles stays cheap
+ * Note: This is a really bad method to generate randomness, and can easily be predicted. It must never be used for cycles with bets
+ * 
+ * @param roll_id - The id of the cyclic roll
+ * @param cycle_number - The number of the idle cycle
+ * @param max_result - The max result of the roll
+ */
+uint32_t pinkgambling::getIdleResult(uint64_t roll_id, uint64_t cycle_number, uint32_t max_result) {
+  uint64_t z = (roll_id * 0x9E3779B97F4A7C15) ^ cycle_number;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+  z = z ^ (z >> 31);
+  return (z % max_result) + 1;
+}
+
+
 /**
  * Calculates the required bankroll of a roll dependant on the current bets of this roll
+ * Rolls with a common max result use the specialized FixedRanges, see getFixedVariance
  * 
  * @param roll_id - The id of the roll to calculate the required bankroll for
  */
@@ -460,22 +1364,103 @@ asset pinkgambling::calculateRollRequiredBankroll(uint64_t roll_id) {
   auto roll_itr = rollsTable.find(roll_id);
   check(roll_itr != rollsTable.end(),
   "no roll with this id exist");
-  rollBets_t betsTable(_self, roll_id);
   
-  ChainedRange firstRange = ChainedRange(1, roll_itr->max_result, 0);
-  asset total_bets_collected = asset(0, CORE_SYMBOL);  // = total_quantity_bet - (rake + fees)
+  double variance = 0;
+  bool fixed_variance = getFixedVariance(roll_itr->max_result, roll_itr->bet_count, roll_itr->collected_sum, [&](auto& ranges) {
+    for (auto bet_itr = betsTable.lower_bound(getBetKey(roll_id, 0)); bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id; bet_itr++) {
+      if (!ranges.insertBet(bet_itr->get_lower_bound(), bet_itr->get_upper_bound(), bet_itr->amount * bet_itr->get_multiplier() / 1000)) {
+        return false;
+      }
+    }
+    return true;
+  }, variance);
+  if (fixed_variance) {
+    return asset((uint64_t)getRequiredBankrollFromVariance(variance), CORE_SYMBOL);
+  }
   
-  for (auto bet_itr = betsTable.begin(); bet_itr != betsTable.end(); bet_itr++) {
-    double ev = (double)bet_itr->multiplier / 1000.0 * (double)(bet_itr->upper_bound - bet_itr->lower_bound + 1) / (double)roll_itr->max_result;
-    total_bets_collected.amount += (int64_t)((double)bet_itr->quantity.amount * (ev + 0.007));
-    
-    uint64_t payout = bet_itr->quantity.amount * bet_itr->multiplier / 1000;
-    firstRange.insertBet(bet_itr->lower_bound, bet_itr->upper_bound, payout);
+  //The ranges of the index are the same as the ones of ChainedRange, but are built in O(n log n) instead of O(n^2)
+  ExposureIndex index = getExposureIndex(roll_id, roll_itr->max_result);
+  variance = index.getVariance(roll_itr->collected_sum);
+  return asset((uint64_t)getRequiredBankrollFromVariance(variance), CORE_SYMBOL);
+}
+
+
+/**
+ * Checks if a bet could be added to a roll, using the same limit as addBet (95% of the bankroll contract's limit)
+ * 
+ * @param roll_id - The id of the roll to check
+ */
+bool pinkgambling::fitsIntoRoll(uint64_t roll_id, asset quantity, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier) {
+  const rollStruct& roll = rollsTable.get(roll_id);
+  uint32_t max_result = roll.max_result;
+  uint64_t payout = quantity.amount * multiplier / 1000;
+  uint64_t collected = getCollectedAmount(quantity.amount, lower_bound, upper_bound, multiplier, max_result);
+  double usable_bankroll = getBankroll().amount * 0.95;
+  
+  //The exact check is only needed if the upper limit from the running sums doesn't already fit, see addBet
+  double variance_bound = getVarianceBound(roll.payout_sum + payout, roll.collected_sum + collected, roll.bet_count + 1, max_result);
+  if (getRequiredBankrollBound(variance_bound) <= usable_bankroll) {
+    return true;
   }
   
-  bankroll_stats_t bankrollStatsTable("roll.pink"_n, "roll.pink"_n.value);
-  asset required_bankroll = getRequiredBankroll(firstRange, total_bets_collected.amount, roll_itr->max_result);
-  return required_bankroll;
+  ChainedRange firstRange = ChainedRange(1, max_result, 0);
+  uint64_t total_bets_collected = insertRollBets(roll_id, firstRange) + collected;
+  //Splits the ranges at the bounds of the bet, see getRequiredBankrollWithBet
+  firstRange.insertBet(lower_bound, upper_bound, 0);
+  
+  asset required_bankroll = getRequiredBankrollWithBet(firstRange, total_bets_collected, max_result, lower_bound, upper_bound, payout);
+  return usable_bankroll >= required_bankroll.amount;
+}
+
+
+/**
+ * Inserts all bets of a roll into the ranges of this roll
+ * 
+ * @param roll_id - The id of the roll to insert the bets of
+ * @param firstRange - The first range of the roll, spanning from 1 to the max result of the roll
+ * @return - The total amount of the bets collected, = total_quantity_bet - (rake + fees)
+ */
+uint64_t pinkgambling::insertRollBets(uint64_t roll_id, ChainedRange& firstRange) {
+  uint32_t max_result = firstRange.upperBound;
+  
+  asset total_bets_collected = asset(0, CORE_SYMBOL);
+  for (auto bet_itr = betsTable.lower_bound(getBetKey(roll_id, 0)); bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id; bet_itr++) {
+    total_bets_collected.amount += getCollectedAmount(bet_itr->amount, bet_itr->get_lower_bound(), bet_itr->get_upper_bound(), bet_itr->get_multiplier(), max_result);
+    
+    uint64_t payout = bet_itr->amount * bet_itr->get_multiplier() / 1000;
+    firstRange.insertBet(bet_itr->get_lower_bound(), bet_itr->get_upper_bound(), payout);
+  }
+  return total_bets_collected.amount;
+}
+
+
+/**
+ * Builds the exposure index of the bets of a roll, see ExposureIndex
+ * 
+ * @param roll_id - The id of the roll
+ * @param max_result - The max result of the roll
+ */
+ExposureIndex pinkgambling::getExposureIndex(uint64_t roll_id, uint32_t max_result) {
+  ExposureIndex index = ExposureIndex(max_result);
+  auto first_bet_itr = betsTable.lower_bound(getBetKey(roll_id, 0));
+  for (auto bet_itr = first_bet_itr; bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id; bet_itr++) {
+    index.addBetBounds(bet_itr->get_lower_bound(), bet_itr->get_upper_bound());
+  }
+  index.build();
+  for (auto bet_itr = first_bet_itr; bet_itr != betsTable.end() && bet_itr->get_roll_id() == roll_id; bet_itr++) {
+    index.insertBet(bet_itr->get_lower_bound(), bet_itr->get_upper_bound(), bet_itr->amount * bet_itr->get_multiplier() / 1000);
+  }
+  return index;
+}
+
+
+/**
+ * Returns the amount that is collected from a bet, = amount - (rake + fees)
+ * The running sums of the rolls use this as well, so that they are equal to the total of insertRollBets
+ */
+uint64_t pinkgambling::getCollectedAmount(uint64_t amount, uint32_t lower_bound, uint32_t upper_bound, uint32_t multiplier, uint32_t max_result) {
+  double ev = (double)multiplier / 1000.0 * (double)(upper_bound - lower_bound + 1) / (double)max_result;
+  return (int64_t)((double)amount * (ev + 0.007));
 }
 
 
@@ -485,10 +1470,18 @@ ACTION pinkgambling::logbet(uint64_t roll_id, uint64_t cycle_number, uint64_t be
   require_auth(_self);
 }
 
+ACTION pinkgambling::logbatchbet(uint64_t roll_id, uint64_t bet_id, uint64_t identifier) {
+  require_auth(_self);
+}
+
 ACTION pinkgambling::logresult(uint64_t roll_id, uint64_t cycle_number, uint32_t max_result, name rake_recipient, uint32_t roll_result, uint64_t identifier, uint32_t cycle_time) {
   require_auth(_self);
 }
 
+ACTION pinkgambling::logidle(uint64_t roll_id, uint64_t first_cycle_number, uint32_t max_result, name rake_recipient, uint32_t cycle_time, std::vector<uint32_t> results) {
+  require_auth(_self);
+}
+
 ACTION pinkgambling::logreduction(uint64_t roll_id, uint64_t cycle_number, double reduction) {
   require_auth(_self);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <eosio/singleton.hpp>
 #include <eosio/print.hpp>
 #include <eosio/crypto.hpp>
+#include <eosio/transaction.hpp>
 
 using namespace eosio;
 
@@ -11,7 +12,8 @@ CONTRACT pinkrandomgn : public contract {
     pinkrandomgn(name receiver, name code, datastream<const char*> ds):contract(receiver, code, ds),
     openJobsTable(receiver, receiver.value),
     usedSeedsTable(receiver, receiver.value),
-    configTable(receiver, receiver.value)
+    configTable(receiver, receiver.value),
+    chainTable(receiver, receiver.value)
     {}
     
     ACTION init();
@@ -19,6 +21,9 @@ CONTRACT pinkrandomgn : public contract {
     ACTION requestrand(uint64_t assoc_id, uint64_t signing_value, name caller);
     ACTION setrand(uint64_t job_id, signature sig);
     ACTION setpubkey(public_key pub_key);
+    ACTION setchain(checksum256 chain_head, uint32_t chain_length);
+    ACTION revealrand(uint64_t job_id, checksum256 preimage);
+    ACTION skiprand(uint64_t job_id, checksum256 preimage);
     ACTION setpaused(bool paused);
     
   private:
@@ -29,6 +34,9 @@ CONTRACT pinkrandomgn : public contract {
       uint64_t assoc_id;
       uint64_t signing_value;
       checksum256 signing_hash;
+      //Position of the preimage in the hash chain that serves this job, 0 if it is served with a signature
+      //Jobs that were requested before the hash chain mode was added don't have it
+      binary_extension<uint32_t> chain_index = 0;
       
       uint64_t primary_key() const { return id; }
     };
@@ -53,10 +61,26 @@ CONTRACT pinkrandomgn : public contract {
     // https://github.com/EOSIO/eosio.cdt/issues/280
     typedef multi_index<"config"_n, configStruct> config_t_for_abi;
     
+    //Hash chain commitment, see setchain. Without it, all jobs are served with signatures
+    TABLE chainStruct {
+      checksum256 head;
+      uint32_t length = 0;
+      uint32_t assigned = 0;  //Number of preimages of the chain that have been assigned to jobs
+      uint32_t revealed = 0;  //Number of preimages of the chain that have been revealed
+      //Chain that replaces this one once all of its assigned preimages are revealed, see setchain
+      checksum256 next_head;
+      uint32_t next_length = 0;
+    };
+    typedef singleton<"chain"_n, chainStruct> chain_t;
+    // https://github.com/EOSIO/eosio.cdt/issues/280
+    typedef multi_index<"chain"_n, chainStruct> chain_t_for_abi;
+    
     
     openjobs_t openJobsTable;
     usedseeds_t usedSeedsTable;
     config_t configTable;
+    chain_t chainTable;
   
     bool isPaused();
+    checksum256 revealPreimage(const openJobsStruct& job, checksum256 preimage);
 };
\ No newline at end of file
@@ -11,6 +11,7 @@ ACTION pinkrandomgn::init() {
  * External contracts can call this function to request a random value
  * The provided signing_value value is hashed with sha256, and the resulting hash is saved.
  * The hash will then be signed off chain, and the result will be called back via the setrand action
+ * While the committed hash chain has preimages left, the job is instead assigned the next of them and served with revealrand
  * 
  * @param assoc_id - The id that will be sent back to the caller together with the random value
  *                   Is meant to track results
@@ -34,12 +35,23 @@ ACTION pinkrandomgn::requestrand(uint64_t assoc_id, uint64_t signing_value, name
   uint64_t id = config.current_job_id++;
   configTable.set(config, _self);
   
+  //The preimage is assigned when the job is requested, so that the order in which jobs are served can't change their results
+  uint32_t chain_index = 0;
+  chainStruct chain = chainTable.get_or_default();
+  if (chain.assigned < chain.length) {
+    chain_index = ++chain.assigned;
+    chainTable.set(chain, _self);
+  }
+  
   openJobsTable.emplace(caller, [&](auto& j){
     j.id = id;
     j.caller = caller;
     j.assoc_id = assoc_id;
     j.signing_value = signing_value;
-    j.signing_hash = sha256((const char *)&signing_value, 8);
+    if (chain_index == 0) {
+      j.signing_hash = sha256((const char *)&signing_value, 8);
+    }
+    j.chain_index = chain_index;
   });
 }
 
@@ -58,6 +70,8 @@ ACTION pinkrandomgn::setrand(uint64_t job_id, signature sig) {
   auto job_itr = openJobsTable.find(job_id);
   check(job_itr != openJobsTable.end(),
   "no job with this id exists");
+  check(job_itr->chain_index.value() == 0,
+  "this job is served from the hash chain, see revealrand");
   
   configStruct config = configTable.get();
   public_key pub_key = config.pub_key;
@@ -82,6 +96,97 @@ ACTION pinkrandomgn::setrand(uint64_t job_id, signature sig) {
 
 
 
+/**
+ * This function will be called from an external script with the preimage of the current chain head for jobs in hash chain mode
+ * Verifying the preimage only takes one sha256, instead of the signature recovery of setrand
+ * The preimage is mixed with the signing_value of the job, so that the result still depends on the caller
+ * 
+ * @param job_id - The id of the job to send the preimage for. The jobs need to be served in the order of their chain_index
+ * @param preimage - The value whose sha256 is the current chain head
+ */
+ACTION pinkrandomgn::revealrand(uint64_t job_id, checksum256 preimage) {
+  require_auth(_self);
+  auto job_itr = openJobsTable.find(job_id);
+  check(job_itr != openJobsTable.end(),
+  "no job with this id exists");
+  
+  checksum256 random_hash = revealPreimage(*job_itr, preimage);
+  
+  action(
+    permission_level{_self, "active"_n},
+    job_itr->caller,
+    "receiverand"_n,
+    std::make_tuple(job_itr->assoc_id, random_hash)
+  ).send();
+  
+  openJobsTable.erase(job_itr);
+}
+
+
+
+
+/**
+ * Serves a hash chain job like revealrand, but sends the random value in a deferred transaction
+ * Used for jobs whose caller fails to process receiverand, so that they don't hold up the later jobs of the chain
+ * The random value is the same one revealrand would have sent, so skipping a job can't change its result
+ * 
+ * @param job_id - The id of the job to send the preimage for
+ * @param preimage - The value whose sha256 is the current chain head
+ */
+ACTION pinkrandomgn::skiprand(uint64_t job_id, checksum256 preimage) {
+  require_auth(_self);
+  auto job_itr = openJobsTable.find(job_id);
+  check(job_itr != openJobsTable.end(),
+  "no job with this id exists");
+  
+  checksum256 random_hash = revealPreimage(*job_itr, preimage);
+  
+  transaction t{};
+  t.actions.emplace_back(
+    permission_level{_self, "active"_n},
+    job_itr->caller,
+    "receiverand"_n,
+    std::make_tuple(job_itr->assoc_id, random_hash)
+  );
+  t.send(job_id, _self);
+  
+  openJobsTable.erase(job_itr);
+}
+
+
+
+
+/**
+ * @dev Allows the devs to commit to a new hash chain, or to disable hash chain mode with a chain_length of 0
+ * The operator picks a secret seed and hashes it chain_length times with sha256. The last hash is the chain_head,
+ * and the hashes before it are revealed backwards, one per job, see revealrand
+ * If preimages of the current chain are still assigned to open jobs, the current chain stops assigning new ones,
+ * and the new chain replaces it once they are all revealed. Jobs requested in between are served with signatures
+ * 
+ * @param chain_head - The last hash of the new chain
+ * @param chain_length - The number of preimages of the new chain that can be assigned to jobs
+ */
+ACTION pinkrandomgn::setchain(checksum256 chain_head, uint32_t chain_length) {
+  require_auth(_self);
+  
+  chainStruct chain = chainTable.get_or_default();
+  if (chain.revealed == chain.assigned) {
+    chain.head = chain_head;
+    chain.length = chain_length;
+    chain.assigned = 0;
+    chain.revealed = 0;
+    chain.next_length = 0;
+  } else {
+    chain.length = chain.assigned;
+    chain.next_head = chain_head;
+    chain.next_length = chain_length;
+  }
+  chainTable.set(chain, _self);
+}
+
+
+
+
 /**
  * @dev Allows the devs to change the public_key
  * Only possible when no bets are open, in order not to risk the randomness integrity
@@ -118,6 +223,44 @@ ACTION pinkrandomgn::setpaused(bool paused) {
 
 
 
+/**
+ * Verifies the preimage of a hash chain job against the current chain head and advances the chain
+ * Switches to the next chain committed with setchain once all assigned preimages are revealed
+ * 
+ * @param job - The job to serve. Needs to be the next job in the order of the hash chain
+ * @param preimage - The value whose sha256 is the current chain head
+ * @return The random hash for the job, which is the hash of the preimage followed by the signing_value
+ */
+checksum256 pinkrandomgn::revealPreimage(const openJobsStruct& job, checksum256 preimage) {
+  check(job.chain_index.value() != 0,
+  "this job is served with a signature, see setrand");
+  
+  chainStruct chain = chainTable.get();
+  check(job.chain_index.value() == chain.revealed + 1,
+  "the jobs have to be served in the order of the hash chain");
+  
+  std::array<uint8_t, 32> preimage_bytes = preimage.extract_as_byte_array();
+  check(sha256((const char *)preimage_bytes.data(), 32) == chain.head,
+  "the preimage does not match the chain head");
+  
+  //The preimage becomes the new head, so that the next preimage is verified against it
+  chain.head = preimage;
+  chain.revealed++;
+  if (chain.revealed == chain.length && chain.next_length != 0) {
+    chain.head = chain.next_head;
+    chain.length = chain.next_length;
+    chain.assigned = 0;
+    chain.revealed = 0;
+    chain.next_length = 0;
+  }
+  chainTable.set(chain, _self);
+  
+  std::vector<char> random_data = pack(std::make_tuple(preimage, job.signing_value));
+  return sha256(random_data.data(), random_data.size());
+}
+
+
+
 bool pinkrandomgn::pinkrandomgn::isPaused() {
   configStruct config = configTable.get();
   return config.paused;
@@ -48,8 +48,9 @@ namespace eosio {
           * Issue action.
           *
           * @details This action issues to `to` account a `quantity` of tokens.
+          * The issuer pays for the RAM of the balance of `to`, if it doesn't exist yet.
           *
-          * @param to - the account to issue tokens to, it must be the same as the issuer,
+          * @param to - the account to issue tokens to,
           * @param quntity - the amount of tokens to be issued,
           * @memo - the memo string that accompanies the token issue transaction.
           */
@@ -34,7 +34,7 @@ void token::issue( const name& to, const asset& quantity, const string& memo )
     auto existing = statstable.find( sym.code().raw() );
     check( existing != statstable.end(), "token with symbol does not exist, create token before issue" );
     const auto& st = *existing;
-    check( to == st.issuer, "tokens can only be issued to issuer account" );
+    check( is_account( to ), "to account does not exist");
 
     require_auth( st.issuer );
     check( quantity.is_valid(), "invalid quantity" );
@@ -47,7 +47,7 @@ void token::issue( const name& to, const asset& quantity, const string& memo )
        s.supply += quantity;
     });
 
-    add_balance( st.issuer, quantity, st.issuer );
+    add_balance( to, quantity, st.issuer );
 }
 
 void token::retire( const asset& quantity, const string& memo )
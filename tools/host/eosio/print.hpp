@@ -0,0 +1,23 @@
+//Minimal replacement of the eosio types that bankrollmanagement.hpp uses, so that it can be compiled and checked on the host
+#pragma once
+#include <cstdint>
+#include <cmath>
+
+typedef unsigned __int128 uint128_t;
+
+struct symbol {
+  symbol() {}
+  symbol(const char* code, uint8_t precision) {}
+};
+
+struct asset {
+  static constexpr int64_t max_amount = (1LL << 62) - 1;
+  int64_t amount = 0;
+  symbol sym;
+  
+  asset() {}
+  asset(int64_t amount, symbol sym) : amount(amount), sym(sym) {}
+  
+  bool operator<=(const asset& other) const { return amount <= other.amount; }
+  bool operator<(const asset& other) const { return amount < other.amount; }
+};
@@ -0,0 +1,86 @@
+/**
+ * Compares the per-job cost of the two ways the oracle serves jobs
+ * Signature mode: sha256 of the signing value, the signature check of setrand and the sha256 of the signature
+ * Hash chain mode: the sha256 of revealrand that checks the preimage against the head, and the sha256 of the preimage and signing value
+ * 
+ * secp256k1 verification stands in for assert_recover_key, which costs about the same
+ * 
+ * Build and run on the host (needs OpenSSL), from the repository root:
+ * g++ -O2 -std=c++17 -Wno-deprecated-declarations -o rng_chain_bench tools/rng_chain_bench.cpp -lcrypto && ./rng_chain_bench
+ */
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+#include <openssl/sha.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+int main() {
+  const int jobCount = 20000;
+  EC_KEY* key = EC_KEY_new_by_curve_name(NID_secp256k1);
+  EC_KEY_generate_key(key);
+  
+  std::vector<uint64_t> signingValues(jobCount);
+  std::vector<ECDSA_SIG*> signatures(jobCount);
+  std::vector<std::vector<unsigned char>> encodedSignatures(jobCount);
+  for (int i = 0; i < jobCount; i++) {
+    signingValues[i] = 0x9e3779b97f4a7c15ULL * (i + 1);
+    unsigned char signingHash[32];
+    SHA256((unsigned char*)&signingValues[i], 8, signingHash);
+    signatures[i] = ECDSA_do_sign(signingHash, 32, key);
+    unsigned char* encoded = nullptr;
+    int encodedLength = i2d_ECDSA_SIG(signatures[i], &encoded);
+    encodedSignatures[i].assign(encoded, encoded + encodedLength);
+    OPENSSL_free(encoded);
+  }
+  
+  //chain[0] is the secret seed, chain[jobCount] is the committed head
+  std::vector<std::array<unsigned char, 32>> chain(jobCount + 1);
+  memset(chain[0].data(), 7, 32);
+  for (int i = 1; i <= jobCount; i++) {
+    SHA256(chain[i - 1].data(), 32, chain[i].data());
+  }
+  
+  volatile unsigned sink = 0;
+  auto signatureStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < jobCount; i++) {
+    unsigned char signingHash[32];
+    unsigned char randomHash[32];
+    SHA256((unsigned char*)&signingValues[i], 8, signingHash);
+    if (ECDSA_do_verify(signingHash, 32, signatures[i], key) != 1) {
+      return 1;
+    }
+    SHA256(encodedSignatures[i].data(), encodedSignatures[i].size(), randomHash);
+    sink += randomHash[0];
+  }
+  
+  auto chainStart = std::chrono::steady_clock::now();
+  unsigned char head[32];
+  memcpy(head, chain[jobCount].data(), 32);
+  for (int i = 0; i < jobCount; i++) {
+    const unsigned char* preimage = chain[jobCount - 1 - i].data();
+    unsigned char preimageHash[32];
+    unsigned char randomHash[32];
+    unsigned char randomData[40];
+    SHA256(preimage, 32, preimageHash);
+    if (memcmp(preimageHash, head, 32) != 0) {
+      return 2;
+    }
+    memcpy(head, preimage, 32);
+    memcpy(randomData, preimage, 32);
+    memcpy(randomData + 32, &signingValues[i], 8);
+    SHA256(randomData, 40, randomHash);
+    sink += randomHash[0];
+  }
+  auto chainEnd = std::chrono::steady_clock::now();
+  
+  double signatureMicros = std::chrono::duration<double, std::micro>(chainStart - signatureStart).count() / jobCount;
+  double chainMicros = std::chrono::duration<double, std::micro>(chainEnd - chainStart).count() / jobCount;
+  printf("signature mode: %.2f us/job, hash chain mode: %.3f us/job, ratio %.0fx\n",
+    signatureMicros, chainMicros, signatureMicros / chainMicros);
+  return 0;
+}
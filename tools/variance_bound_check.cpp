@@ -0,0 +1,106 @@
+/**
+ * Checks that the upper limit of the required bankroll from the running sums of a roll (getVarianceBound)
+ * is never smaller than the exact required bankroll of its ranges (getRequiredBankroll)
+ * 
+ * Half of the rolls are random, the other half cluster the bounds of their bets so that their intersections
+ * create ranges close to the narrowest width with a positive maxBetFactor, which is where the risk of a range is largest
+ * 
+ * The exact pass is only skipped if the bound fits into the bankroll. For a roll whose exact required bankroll is
+ * the share f of the bankroll, this is the case if bound / exact <= 1 / f. The share of rolls that skip it is printed for some f
+ * 
+ * Build and run on the host, from the repository root:
+ * g++ -O2 -std=c++17 -Itools/host -o variance_bound_check tools/variance_bound_check.cpp && ./variance_bound_check
+ */
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "../bankroll-contract/include/bankrollmanagement.hpp"
+
+int main() {
+  std::mt19937_64 rng(42);
+  std::vector<uint32_t> maxResults = {2, 37, 100, 626, 1000, 1252, 6260, 10000, 12345, 100000, 626000, 1048575};
+  long checkedCount = 0;
+  long underEstimateCount = 0;
+  //Ratios of the random rolls [0] and of the clustered rolls [1]
+  std::vector<double> ratios[2];
+  
+  for (int iteration = 0; iteration < 400000; iteration++) {
+    uint32_t maxResult = maxResults[rng() % maxResults.size()];
+    int betCount = 1 + rng() % 40;
+    bool clustered = rng() % 2 && maxResult >= 200;
+    uint32_t narrowestWidth = maxResult / 626 + 1;
+    
+    ChainedRange firstRange = ChainedRange(1, maxResult, 0);
+    uint64_t totalBetAmount = 0;
+    uint64_t payoutSum = 0;
+    uint32_t insertedCount = 0;
+    for (int i = 0; i < betCount; i++) {
+      uint32_t lowerBound;
+      uint32_t upperBound;
+      if (clustered) {
+        uint32_t position = 1 + rng() % (maxResult - narrowestWidth);
+        uint32_t span = (uint32_t)std::max(0.005 * maxResult, 1.0) + rng() % (maxResult / 4 + 1);
+        if (rng() % 2) {
+          lowerBound = position;
+          upperBound = (uint32_t)std::min<uint64_t>(maxResult, (uint64_t)position + span);
+        } else {
+          upperBound = position + narrowestWidth - 1;
+          lowerBound = upperBound > span ? upperBound - span : 1;
+        }
+      } else {
+        lowerBound = 1 + rng() % maxResult;
+        upperBound = lowerBound + rng() % (maxResult - lowerBound + 1);
+      }
+      
+      //Same limits as checkBetParameters of the gambling contract
+      double odds = (double)(upperBound - lowerBound + 1) / maxResult;
+      uint32_t maxMultiplier = (uint32_t)(0.99 / odds * 1000);
+      if (odds < 0.005 || maxMultiplier <= 1001) {
+        continue;
+      }
+      uint32_t multiplier = 1001 + rng() % (std::min<uint32_t>(maxMultiplier, 262143) - 1000);
+      int64_t amount = 1 + rng() % (rng() % 2 ? 100000000LL : 100000000000LL);
+      
+      double ev = (double)multiplier / 1000.0 * odds;
+      totalBetAmount += (int64_t)((double)amount * (ev + 0.007));
+      uint64_t payout = amount * multiplier / 1000;
+      payoutSum += payout;
+      insertedCount++;
+      firstRange.insertBet(lowerBound, upperBound, payout);
+    }
+    if (insertedCount == 0) {
+      continue;
+    }
+    checkedCount++;
+    
+    double exact = (double)getRequiredBankroll(firstRange, totalBetAmount, maxResult).amount;
+    double bound = getRequiredBankrollBound(getVarianceBound(payoutSum, totalBetAmount, insertedCount, maxResult));
+    if (bound < exact) {
+      underEstimateCount++;
+      if (underEstimateCount <= 5) {
+        printf("under-estimate: max result %u, exact %f, bound %f\n", maxResult, exact, bound);
+      }
+    }
+    if (exact > 0) {
+      ratios[clustered ? 1 : 0].push_back(bound / exact);
+    }
+  }
+  
+  printf("rolls %ld, under-estimates %ld\n", checkedCount, underEstimateCount);
+  const char* names[2] = {"random", "clustered"};
+  for (int kind = 0; kind < 2; kind++) {
+    std::vector<double>& kindRatios = ratios[kind];
+    std::sort(kindRatios.begin(), kindRatios.end());
+    size_t size = kindRatios.size();
+    printf("%s rolls %zu, bound / exact: min %.2f, 10%% %.2f, median %.2f, 90%% %.2f\n", names[kind], size,
+      kindRatios.front(), kindRatios[size / 10], kindRatios[size / 2], kindRatios[size * 9 / 10]);
+    printf("  share of rolls that skip the exact pass, by exact required bankroll / bankroll:");
+    for (double share : {0.0001, 0.001, 0.01, 0.1, 0.5}) {
+      size_t skipping = std::upper_bound(kindRatios.begin(), kindRatios.end(), 1.0 / share) - kindRatios.begin();
+      printf(" %g: %.1f%%", share, 100.0 * skipping / size);
+    }
+    printf("\n");
+  }
+  return underEstimateCount == 0 ? 0 : 1;
+}